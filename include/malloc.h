@@ -8,6 +8,21 @@ void *xalloc(size_t size, size_t alignment, unsigned int type_flags)
 // Return 1 if failed to free memory (locked and will not block)
 int free_try(void *ptr);
 
+// Can be called from any context, including IRQs. The memory is given
+// back on the next allocation or free() from thread context
+void free_deferred(void *ptr);
+
+// Allocate from IRQ context. Blocks of up to MALLOC_IRQ_SIZE bytes come
+// from a reserve that must first be set up from thread context with
+// malloc_irq_reserve(). Returns NULL if the reserve is empty. Release
+// with free() or free_deferred()
+#define MALLOC_IRQ_SIZE 256
+
+void *malloc_irq(size_t size) __attribute__((malloc,warn_unused_result));
+
+// Add count blocks to the reserve
+void malloc_irq_reserve(int count);
+
 #define MEM_TYPE_DMA   0x1
 #define MEM_TYPE_LOCAL 0x2
 
@@ -16,3 +31,19 @@ int free_try(void *ptr);
 #define HEAP_START_EBSS 0xffffffff
 
 void heap_add_mem(long start, long end, int type);
+
+typedef struct {
+  size_t used;
+  size_t free;
+  size_t largest_free;
+} heap_stats_t;
+
+// Totals over heaps of the given type, -1 for all heaps
+void heap_get_stats(heap_stats_t *hs, int type);
+
+// Percent of free memory not usable for an allocation of all of it
+static inline int
+heap_fragmentation(const heap_stats_t *hs)
+{
+  return hs->free ? 100 - (int)(hs->largest_free * 100 / hs->free) : 0;
+}
@@ -5,15 +5,55 @@
 
 #include "error.h"
 
+/*
+ * Bump allocator (arena)
+ *
+ * Memory is handed out from the inline data[] block. An arena with a
+ * non-zero limit grows by chaining extra chunks from the heap, up to
+ * limit bytes in total. Chained chunks are given back by
+ * balloc_rewind() / balloc_reset(). Standard sized chunks are kept on a
+ * small free list for the next arena.
+ *
+ * Data appended with balloc_append_data() is always contiguous, if it
+ * outgrows a chunk it is moved to a new one.
+ */
+
+typedef struct balloc_chunk balloc_chunk_t;
+
 typedef struct balloc {
+  balloc_chunk_t *chunks; // Newest first, allocations are made from first
+  size_t limit;           // Max bytes in chained chunks, 0 for fixed size
+  size_t chained;         // Bytes in chained chunks
+  size_t peak;            // High-water mark, updated on rewind/reset
   size_t capacity;
   size_t used;
   uint8_t data[0];
 } balloc_t;
 
+typedef struct {
+  balloc_chunk_t *chunk;
+  size_t used;
+} balloc_mark_t;
+
 balloc_t *balloc_create(size_t capacity);
 
+// For arenas embedded in other structs, data[] must have room for
+// capacity bytes
+void balloc_init(balloc_t *ba, size_t capacity, size_t limit);
+
 void *balloc_append_data(balloc_t *ba, const void *src, size_t srclen,
                          void **ptr, size_t *sizep);
 
 void *balloc_alloc(balloc_t *ba, size_t size);
+
+// Bytes currently allocated
+size_t balloc_size(const balloc_t *ba);
+
+balloc_mark_t balloc_mark(const balloc_t *ba);
+
+// Release everything allocated after the mark was taken
+void balloc_rewind(balloc_t *ba, balloc_mark_t mark);
+
+// Release everything. Must be called before freeing an arena that
+// may have grown
+void balloc_reset(balloc_t *ba);
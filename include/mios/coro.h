@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+#include "task.h"
+#include "timer.h"
+
+/*
+ * Stackless coroutines
+ *
+ * A coroutine is a function that is re-entered from the top each time
+ * it is resumed and jumps to where it left off (protothread style).
+ * All coroutines share the stack of a single executor thread so a
+ * suspended coroutine costs only its coro_t. Local variables are NOT
+ * preserved across suspension points, keep state in a struct that
+ * embeds the coro_t.
+ *
+ *   static int
+ *   session(coro_t *co)
+ *   {
+ *     session_t *s = (session_t *)co;
+ *     CORO_BEGIN(co);
+ *     while(1) {
+ *       CORO_WAIT_UNTIL(co, &s->wait, 0, s->pending);
+ *       ...
+ *     }
+ *     CORO_END(co);
+ *   }
+ *
+ * Coroutines suspend on any task_waitable_t (including cond_t) and are
+ * resumed by the regular task_wakeup() / cond_signal(). The condition
+ * is evaluated with IRQ_LEVEL_SCHED blocked, so it must be cheap and
+ * the wakeup must come after the state it tests has been updated.
+ *
+ * Since all coroutines run on the same thread they must not block
+ * (short mutex sections are fine) and never use more than one CORO_*
+ * suspension macro per source line.
+ */
+
+#define CORO_DONE    0  // Finished, executor will not touch coro_t again
+#define CORO_WAITING 1  // Suspended
+
+typedef struct coro {
+  task_t co_task; // Placed on wait lists while suspended
+  STAILQ_ENTRY(coro) co_link;
+  int (*co_fn)(struct coro *co);
+  task_waitable_t *co_waitable;
+  timer_t co_timer;
+  uint16_t co_line;
+  uint8_t co_timedout;
+} coro_t;
+
+// Start coroutine, must be called from a thread
+void coro_start(coro_t *co, int (*fn)(coro_t *co));
+
+// Helpers for the macros below
+int coro_lock(void);
+
+void coro_unlock(int q);
+
+void coro_sleep_locked(coro_t *co, task_waitable_t *waitable,
+                       int64_t deadline);
+
+void coro_wait_done(coro_t *co, int q);
+
+void coro_yield(coro_t *co);
+
+// Called by task_wakeup_sched_locked()
+void coro_wakeup_sched_locked(task_t *t);
+
+
+#define CORO_BEGIN(co) switch((co)->co_line) { case 0:
+
+#define CORO_END(co) } return CORO_DONE
+
+// Suspend until cond is true, or deadline (unless 0) passes in which
+// case CORO_TIMEDOUT() is true afterwards. waitable can be NULL to
+// just sleep
+#define CORO_WAIT_UNTIL(co, waitable, deadline, cond)                   \
+  do {                                                                  \
+    (co)->co_line = __LINE__;                                           \
+    (co)->co_timedout = 0;                                              \
+  case __LINE__:;                                                       \
+    const int q_ = coro_lock();                                         \
+    if(!(cond) && !(co)->co_timedout) {                                 \
+      coro_sleep_locked(co, waitable, deadline);                        \
+      coro_unlock(q_);                                                  \
+      return CORO_WAITING;                                              \
+    }                                                                   \
+    coro_wait_done(co, q_);                                             \
+  } while(0)
+
+#define CORO_SLEEP_UNTIL(co, deadline)                  \
+  CORO_WAIT_UNTIL(co, NULL, deadline, 0)
+
+#define CORO_TIMEDOUT(co) ((co)->co_timedout)
+
+// Let other coroutines run
+#define CORO_YIELD(co)                                                  \
+  do {                                                                  \
+    (co)->co_line = __LINE__;                                           \
+    coro_yield(co);                                                     \
+    return CORO_WAITING;                                                \
+  case __LINE__:;                                                       \
+  } while(0)
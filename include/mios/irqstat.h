@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <mios/mios.h>
+
+/*
+ * IRQ statistics (ENABLE_IRQSTAT)
+ *
+ * Log2 histograms of handler duration per vector, entry latency of
+ * the clock IRQ and the length of sections run with IRQs masked.
+ * Collected between 'irqstat-start' and 'irqstat-stop', shown by
+ * 'irqstat'. Time is in the unit of the CPU's cycle counter.
+ *
+ * The functions below are called by the CPU's IRQ code
+ */
+
+#ifdef ENABLE_IRQSTAT
+
+extern uint8_t irqstat_enabled;
+
+// Called with IRQs masked (after masking / before unmasking)
+void irqstat_mask_begin(void);
+
+void irqstat_mask_end(void);
+
+void irqstat_irq(int vector, uint32_t duration);
+
+void irqstat_irq_latency(uint32_t latency);
+
+#define irqstat_mask_event(fn) do {                       \
+    if(unlikely(irqstat_enabled))                         \
+      fn();                                               \
+  } while(0)
+
+#else
+
+#define irqstat_mask_event(fn) do {} while(0)
+
+#endif
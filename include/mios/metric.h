@@ -4,6 +4,8 @@
 
 #include <stdint.h>
 
+#include "seqlock.h"
+
 SLIST_HEAD(metric_slist, metric);
 
 extern struct metric_slist metrics;
@@ -42,6 +44,7 @@ typedef struct metric_def {
 typedef struct metric {
   SLIST_ENTRY(metric) link;
   const metric_def_t *def;
+  seqlock_t seq;  // Lets readers snapshot stats without irq_forbid()
   float min;
   float max;
   float mean;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Sampling profiler (ENABLE_PERF)
+ *
+ * Platforms with a spare hardware timer implement perf_hwtimer_start()
+ * and perf_hwtimer_stop(), and call perf_sample_irq() from the timer's
+ * IRQ (at IRQ_LEVEL_CLOCK). Without them samples are taken by a kernel
+ * timer.
+ */
+
+// Start sampling every 'period' µs. Returns the name of the timer or
+// NULL if there is none (or it can't do 'period'). IRQ_LEVEL_CLOCK is
+// blocked
+const char *perf_hwtimer_start(uint32_t period);
+
+// IRQ_LEVEL_CLOCK is blocked
+void perf_hwtimer_stop(void);
+
+// Record a sample of the interrupted thread. Returns µs until the next
+// sample, which is randomized around the requested period
+uint32_t perf_sample_irq(void);
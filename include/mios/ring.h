@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "task.h"
+
+/*
+ * Lock-free ring buffers for handing data from IRQs to threads
+ *
+ * Capacity can be any number of elements of any size. Positions run
+ * from 0 to 2 * size - 1 so full and empty can be told apart without
+ * wasting a slot (and without any division).
+ *
+ * SPSC: A single producer and a single consumer.
+ *
+ * MPSC: Any number of producers (threads and IRQs at any level) and a
+ *       single consumer. Producers reserve space with compare-and-swap
+ *       and mark each slot as ready when written. The consumer stops at
+ *       the first slot not yet ready, so a preempted producer never
+ *       blocks anyone else.
+ *
+ * The consumer can sleep on the ring with ring_get_wait(). Producers
+ * wake it when they add to a ring it has drained, unless RING_NOWAKE
+ * is passed which must be done when producing from an IRQ above
+ * IRQ_LEVEL_SCHED.
+ */
+
+typedef struct ring {
+  uint32_t r_head;       // Producer position (reserve position for MPSC)
+  uint32_t r_tail;       // Consumer position
+  uint32_t r_size;       // Capacity in elements
+  uint32_t r_esize;      // Element size
+  uint8_t *r_buf;
+  uint8_t *r_ready;      // MPSC only, per slot committed flag
+  task_waitable_t r_wait;
+} ring_t;
+
+#define RING_SPSC_DECL(name, type, size)        \
+  struct {                                      \
+    ring_t r;                                   \
+    type buf[size];                             \
+  } name
+
+#define RING_MPSC_DECL(name, type, size)        \
+  struct {                                      \
+    ring_t r;                                   \
+    type buf[size];                             \
+    uint8_t ready[size];                        \
+  } name
+
+#define RING_NOWAKE 0x1
+
+void ring_init(ring_t *r, void *buf, size_t esize, size_t size,
+               uint8_t *ready, const char *name);
+
+#define ring_spsc_init(x, name)                                         \
+  ring_init(&(x)->r, (x)->buf, sizeof((x)->buf[0]),                     \
+            sizeof((x)->buf) / sizeof((x)->buf[0]), NULL, name)
+
+#define ring_mpsc_init(x, name)                                         \
+  ring_init(&(x)->r, (x)->buf, sizeof((x)->buf[0]),                     \
+            sizeof((x)->buf) / sizeof((x)->buf[0]), (x)->ready, name)
+
+// Enqueue up to count elements, returns number enqueued
+size_t ring_put(ring_t *r, const void *src, size_t count, int flags);
+
+// Dequeue up to count elements, returns number dequeued
+size_t ring_get(ring_t *r, void *dst, size_t count);
+
+// As ring_get() but sleep until at least one element is available or
+// deadline (unless 0) expires. Returns 0 on timeout
+size_t ring_get_wait(ring_t *r, void *dst, size_t count, int64_t deadline);
+
+// Number of elements enqueued (some may not be ready yet for MPSC)
+size_t ring_used(const ring_t *r);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Sequence lock for small, frequently read values
+ *
+ * Readers never block writers, they just retry if a write happened
+ * while reading:
+ *
+ *   do {
+ *     seq = seqlock_read_begin(&sl);
+ *     copy = value;
+ *   } while(seqlock_read_retry(&sl, seq));
+ *
+ * Writers must be serialized by other means (typically by running in,
+ * or blocking, the IRQ that updates the value) and must not be
+ * interrupted by a reader that loops until success, as that reader
+ * would spin forever
+ */
+
+typedef struct seqlock {
+  uint32_t seq;
+} seqlock_t;
+
+#define SEQLOCK_INITIALIZER {}
+
+
+static inline uint32_t __attribute__((always_inline))
+seqlock_read_begin(const seqlock_t *sl)
+{
+  return __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+}
+
+
+static inline int __attribute__((always_inline))
+seqlock_read_retry(const seqlock_t *sl, uint32_t start)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (start & 1) || __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+
+static inline void __attribute__((always_inline))
+seqlock_write_begin(seqlock_t *sl)
+{
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static inline void __attribute__((always_inline))
+seqlock_write_end(seqlock_t *sl)
+{
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+#include "task.h"
+
+/*
+ * Fixed size object caches
+ *
+ * Objects are carved out of slabs taken from the heap and kept on a
+ * per-slab free list, so allocating does not touch the heap lock.
+ * Freeing finds the owning slab by address among the cache's partial
+ * and full slabs, which are few. One empty slab is kept per
+ * cache, the rest are returned to the heap. slab_reclaim() returns all
+ * empty slabs and is called by the heap before failing an allocation.
+ *
+ * Caches are defined statically and set up on first allocation. If a
+ * constructor is given it is called on every object returned by
+ * slab_alloc(), otherwise the contents are undefined.
+ *
+ * May only be used from thread context.
+ */
+
+typedef struct slab_cache {
+  const char *sc_name;
+  void (*sc_ctor)(void *obj);
+  mutex_t sc_mutex;
+  LIST_HEAD(, slab) sc_partial;
+  LIST_HEAD(, slab) sc_full;
+  LIST_HEAD(, slab) sc_empty;
+  SLIST_ENTRY(slab_cache) sc_link;
+
+  uint16_t sc_size;
+  uint16_t sc_per_slab;   // 0 until set up
+  uint32_t sc_slab_size;
+
+  uint16_t sc_slabs;
+  uint16_t sc_inuse;
+  uint16_t sc_peak;
+  uint16_t sc_num_empty;
+  uint32_t sc_fails;
+} slab_cache_t;
+
+#define SLAB_CACHE_INITIALIZER(name, type, ctor) {       \
+    .sc_name = (name),                                   \
+    .sc_ctor = (ctor),                                   \
+    .sc_mutex = MUTEX_INITIALIZER(name),                 \
+    .sc_size = sizeof(type) }
+
+// Returns NULL if out of memory
+void *slab_alloc(slab_cache_t *sc) __attribute__((malloc,warn_unused_result));
+
+void slab_free(slab_cache_t *sc, void *obj);
+
+// Give empty slabs back to the heap, returns number of bytes freed
+size_t slab_reclaim(void);
+
+struct stream;
+
+void slab_print_stats(struct stream *st);
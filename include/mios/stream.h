@@ -8,6 +8,7 @@
 
 #define STREAM_WRITE_NO_WAIT  0x1
 #define STREAM_WRITE_WAIT_DTR 0x2
+#define STREAM_WRITE_STATIC   0x4 // buf stays valid forever, may be referenced
 
 typedef struct stream {
 
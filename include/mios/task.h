@@ -8,6 +8,7 @@
 
 STAILQ_HEAD(task_queue, task);
 LIST_HEAD(task_list, task);
+SLIST_HEAD(mutex_slist, mutex);
 
 #define TASK_PRIOS 32
 #define TASK_PRIO_MASK (TASK_PRIOS - 1)
@@ -53,6 +54,21 @@ void task_run(task_t *t);
  */
 
 
+#if defined(ENABLE_TASK_ACCOUNTING) && defined(ENABLE_LOAD_HISTORY)
+
+#define LOAD_HISTORY_SECONDS 60
+#define LOAD_HISTORY_MINUTES 60
+
+// Load in 0.01% units. Rings are indexed by the number of seconds
+// recorded so far, see load_history_get()
+typedef struct load_history {
+  uint16_t lh_sec[LOAD_HISTORY_SECONDS];
+  uint16_t lh_min[LOAD_HISTORY_MINUTES]; // Average of each minute
+  uint32_t lh_min_acc;
+} load_history_t;
+
+#endif
+
 typedef struct thread {
   task_t t_task;
 
@@ -72,12 +88,23 @@ typedef struct thread {
   uint32_t t_load;
   uint32_t t_ctx_switches_acc;
   uint32_t t_ctx_switches;
+#ifdef ENABLE_LOAD_HISTORY
+  load_history_t t_load_history;
+#endif
 #endif
 
   SLIST_ENTRY(thread) t_global_link;
 
+  struct mutex *t_mutex_wait;      // Mutex we're blocked on
+  struct mutex_slist t_mutexes;    // Contended mutexes owned by us
+
+  struct thread_periodic *t_periodic; // Set for thread_create_periodic()
+
+  uint32_t t_stack_peak; // Highest stack usage seen (bytes)
+
   char t_name[11];
   uint8_t t_refcount;
+  uint8_t t_base_prio;  // Priority when not boosted by mutex waiters
 } thread_t;
 
 typedef struct sched_cpu {
@@ -113,11 +140,24 @@ typedef struct {
 #endif
 
 
-typedef struct {
-  union {
-    task_waitable_t waiters;
-    intptr_t lock;
-  };
+/*
+ * mutex->lock is the owning thread | MUTEX_LOCKED, or 0 when unlocked.
+ * MUTEX_CONTENDED is set while there are waiters which forces unlock
+ * through the slow path. Contended mutexes are also linked on their
+ * owner's t_mutexes list so the owner's priority can be recomputed
+ * (priority inheritance) when they are released
+ */
+
+#define MUTEX_CONTENDED 0x1
+#define MUTEX_LOCKED    0x2
+
+typedef struct mutex {
+  task_waitable_t waiters;
+  intptr_t lock;
+  SLIST_ENTRY(mutex) link;
+#ifdef ENABLE_MUTEX_STATS
+  uint32_t acquired; // Timestamp of last acquisition
+#endif
 } mutex_t;
 
 typedef task_waitable_t cond_t;
@@ -128,6 +168,10 @@ void thread_init_cpu(sched_cpu_t *sc, const char *cpu_name, void *sp_bottom);
 // Flag bits 0-7 is stored in task->t_flags
 #define TASK_THREAD    0x1  // A full thread with stack
 #define TASK_DETACHED  0x2  // Should be auto-joined by system on thread_exit
+#define TASK_STACK_LOW 0x4  // Low stack warning has been logged
+#define TASK_WAITER    0x8  // Proxy for a thread in task_wait_any()
+#define TASK_CORO      0x10 // Stackless coroutine, see coro.h
+#define TASK_STACK_POOL 0x20 // Recycle stack via pool (ENABLE_STACK_POOL)
 
 // Remaining flags are used during thread_create
 #ifdef HAVE_FPU
@@ -139,6 +183,24 @@ void thread_init_cpu(sched_cpu_t *sc, const char *cpu_name, void *sp_bottom);
 thread_t *thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
                         const char *name, int flags, unsigned int prio);
 
+/*
+ * Periodic threads
+ *
+ * fn is invoked at creation time + phase + n * period (all in µs).
+ * Release times are derived from the first one so they don't drift.
+ * An activation that has not returned by its release + deadline
+ * (period if 0) is counted as a missed deadline, and so are releases
+ * that were skipped because fn overran them. Execution time in the
+ * stats is measured from release to return of fn, so it includes
+ * wakeup latency and preemption. The thread exits when fn returns
+ * non-zero
+ */
+thread_t *thread_create_periodic(int (*fn)(void *arg), void *arg,
+                                 size_t stack_size, const char *name,
+                                 int flags, unsigned int prio,
+                                 uint32_t period, uint32_t phase,
+                                 uint32_t deadline);
+
 void thread_exit(void *ret) __attribute__((noreturn));
 
 void *thread_join(thread_t *t);
@@ -161,14 +223,49 @@ int task_sleep_deadline(task_waitable_t *waitable, int64_t deadline)
 int task_sleep_delta(task_waitable_t *waitable, int useconds)
   __attribute__((warn_unused_result));
 
+/*
+ * Sleep on several waitables at once. Returns the index of the
+ * waitable that woke us, or -1 if deadline (unless 0) expired first.
+ * A wakeup of one waitable is consumed by at most one sleeper as
+ * with task_sleep(). Not for mutexes
+ */
+int task_wait_any(task_waitable_t *const *waitables, size_t count,
+                  int64_t deadline);
+
+// Use if you have irq_forbid(IRQ_LEVEL_SCHED)
+int task_wait_any_sched_locked(task_waitable_t *const *waitables,
+                               size_t count, int64_t deadline);
+
 thread_t *thread_current(void);
 
+// Iterate over all threads. The returned thread is retained and cur
+// is released, so the loop must run to the end (NULL)
+thread_t *thread_get_next(thread_t *cur);
+
+#if defined(ENABLE_TASK_ACCOUNTING) && defined(ENABLE_LOAD_HISTORY)
+// Copy load history of t (NULL for the idle thread). Returns the
+// number of seconds recorded so far
+uint32_t load_history_get(const thread_t *t, load_history_t *lh);
+#endif
+
+#if defined(ENABLE_TRACE) || defined(ENABLE_PERF)
+// Copy name of thread p into buf, returns -1 if p is not a live thread
+int thread_get_name(const void *p, char *buf, size_t len);
+#endif
+
 #ifdef ENABLE_TASK_WCHAN
 #define MUTEX_INITIALIZER(n) { .waiters = {.name = (n)}}
 #else
 #define MUTEX_INITIALIZER(n) {}
 #endif
 
+#ifdef ENABLE_MUTEX_STATS
+// Every operation takes the slow path so it can be accounted for
+#define MUTEX_FAST_PATH 0
+#else
+#define MUTEX_FAST_PATH __atomic_always_lock_free(sizeof(intptr_t), 0)
+#endif
+
 
 inline void  __attribute__((always_inline))
 mutex_init(mutex_t *m, const char *name)
@@ -177,6 +274,14 @@ mutex_init(mutex_t *m, const char *name)
 #ifdef ENABLE_TASK_WCHAN
   m->waiters.name = name;
 #endif
+  m->lock = 0;
+}
+
+// Returns NULL if unlocked (or locked before scheduler was started)
+inline thread_t *  __attribute__((always_inline))
+mutex_owner(const mutex_t *m)
+{
+  return (thread_t *)(m->lock & ~(MUTEX_CONTENDED | MUTEX_LOCKED));
 }
 
 void mutex_lock_slow(mutex_t *m);
@@ -184,9 +289,11 @@ void mutex_lock_slow(mutex_t *m);
 inline void  __attribute__((always_inline))
 mutex_lock(mutex_t *m)
 {
-  if(__atomic_always_lock_free(sizeof(intptr_t), 0)) {
+  if(MUTEX_FAST_PATH) {
     intptr_t expected = 0;
-    if(__builtin_expect(__atomic_compare_exchange_n(&m->lock, &expected, 1, 1,
+    const intptr_t self = (intptr_t)thread_current() | MUTEX_LOCKED;
+    if(__builtin_expect(__atomic_compare_exchange_n(&m->lock, &expected,
+                                                    self, 1,
                                                     __ATOMIC_SEQ_CST,
                                                     __ATOMIC_RELAXED), 1))
       return;
@@ -202,9 +309,11 @@ int mutex_trylock_slow(mutex_t *m);
 inline int  __attribute__((always_inline))
 mutex_trylock(mutex_t *m)
 {
-  if(__atomic_always_lock_free(sizeof(intptr_t), 0)) {
+  if(MUTEX_FAST_PATH) {
     intptr_t expected = 0;
-    if(__builtin_expect(__atomic_compare_exchange_n(&m->lock, &expected, 1, 1,
+    const intptr_t self = (intptr_t)thread_current() | MUTEX_LOCKED;
+    if(__builtin_expect(__atomic_compare_exchange_n(&m->lock, &expected,
+                                                    self, 1,
                                                     __ATOMIC_SEQ_CST,
                                                     __ATOMIC_RELAXED), 1))
       return 0;
@@ -218,8 +327,8 @@ void mutex_unlock_slow(mutex_t *m);
 inline void  __attribute__((always_inline))
 mutex_unlock(mutex_t *m)
 {
-  if(__atomic_always_lock_free(sizeof(intptr_t), 0)) {
-    intptr_t expected = 1;
+  if(MUTEX_FAST_PATH) {
+    intptr_t expected = (intptr_t)thread_current() | MUTEX_LOCKED;
     if(__builtin_expect(__atomic_compare_exchange_n(&m->lock, &expected, 0, 1,
                                                     __ATOMIC_SEQ_CST,
                                                     __ATOMIC_RELAXED), 1))
@@ -253,6 +362,34 @@ void cond_wait(cond_t *c, mutex_t *m);
 int cond_wait_timeout(cond_t *c, mutex_t *m, uint64_t deadline)
   __attribute__((warn_unused_result));
 
+/*
+ * Reader-writer lock for read-mostly data. Writers have preference,
+ * once a writer is waiting new readers will block.
+ * There is no priority inheritance
+ */
+
+typedef struct rwlock {
+  task_waitable_t rw_readers;
+  task_waitable_t rw_writers;
+  int16_t rw_count;             // Number of readers, -1 if write locked
+  uint16_t rw_writers_waiting;
+} rwlock_t;
+
+#define RWLOCK_INITIALIZER(n) {                 \
+    .rw_readers = WAITABLE_INITIALIZER(n),      \
+    .rw_writers = WAITABLE_INITIALIZER(n),      \
+  }
+
+void rwlock_init(rwlock_t *rw, const char *name);
+
+void rwlock_rdlock(rwlock_t *rw);
+
+void rwlock_rdunlock(rwlock_t *rw);
+
+void rwlock_wrlock(rwlock_t *rw);
+
+void rwlock_wrunlock(rwlock_t *rw);
+
 // Helper for constructing a task used for cli/shell activities
 
 error_t task_create_shell(void *(*entry)(void *arg), void *arg,
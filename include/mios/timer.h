@@ -3,7 +3,28 @@
 #include <stdint.h>
 #include <sys/queue.h>
 
-LIST_HEAD(timer_list, timer);
+LIST_HEAD(timer_slot, timer);
+
+// Each level costs (1 << TIMER_WHEEL_BITS) list heads per timer list,
+// platforms short on RAM can override these
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS   4  // Slots per level is 1 << TIMER_WHEEL_BITS
+#endif
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS 3
+#endif
+#define TIMER_WHEEL_SHIFT  10 // Level 0 slots are 1.024ms wide
+
+// Hierarchical timer wheel. Deadlines beyond the last level (~4s with
+// the defaults) are kept on an unsorted overflow list which is scanned
+// whenever the wheel moves into a new span
+struct timer_list {
+  uint64_t tl_base;                // Wheel time in level 0 slots
+  struct timer_slot tl_cur;        // Timers at or before tl_base, sorted
+  struct timer_slot tl_overflow;
+  uint32_t tl_pending[TIMER_WHEEL_LEVELS]; // Maybe non-empty slots
+  struct timer_slot tl_slots[TIMER_WHEEL_LEVELS][1 << TIMER_WHEEL_BITS];
+};
 
 typedef struct timer {
   LIST_ENTRY(timer) t_link;
@@ -24,5 +45,9 @@ void timer_arm_on_queue(timer_t *t, uint64_t deadline, struct timer_list *tl);
 
 void timer_dispatch(struct timer_list *tl, uint64_t now);
 
+// Earliest time timer_dispatch() might have something to do,
+// UINT64_MAX if no timers are armed. May be early but never late
+uint64_t timer_next(struct timer_list *tl);
+
 void timer_init(timer_t *t, void (*cb)(void *opaque, uint64_t expire),
                 void *opaque, const char *name, uint64_t deadline);
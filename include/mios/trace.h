@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <mios/mios.h>
+
+// Scheduler trace events
+#define TRACE_SWITCH      1 // a: Previous thread, b: Next thread
+#define TRACE_WAKEUP      2 // a: Task woken up, b: Current thread
+#define TRACE_MUTEX_BLOCK 3 // a: Mutex, b: Owner
+#define TRACE_IRQ_ENTER   4 // arg: IRQ number (-1 for SysTick)
+#define TRACE_IRQ_EXIT    5 // arg: IRQ number
+
+#ifdef ENABLE_TRACE
+
+extern uint8_t trace_enabled;
+
+void trace_record(uint8_t type, int16_t arg, const void *a, const void *b);
+
+#define trace_event(type, arg, a, b) do {                  \
+    if(unlikely(trace_enabled))                            \
+      trace_record(type, arg, a, b);                       \
+  } while(0)
+
+#else
+
+#define trace_event(type, arg, a, b) do {} while(0)
+
+#endif
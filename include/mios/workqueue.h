@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+#include "error.h"
+#include "task.h"
+#include "timer.h"
+
+/*
+ * Work queues
+ *
+ * Run short functions on a small pool of worker threads instead of
+ * creating a thread per job. Work items are owned by the caller and
+ * can be submitted from threads and from IRQs at or below
+ * IRQ_LEVEL_SCHED. A work item that is already queued is not queued
+ * again. Queues are bounded, submitting to a full queue fails with
+ * ERR_NO_BUFFER.
+ *
+ * Work functions may block, but doing so holds up the rest of the
+ * queue unless it has more than one worker.
+ */
+
+typedef struct work {
+  STAILQ_ENTRY(work) w_link;
+  void (*w_fn)(struct work *w);
+  uint32_t w_queued;  // clock_get() at submission (truncated)
+  uint8_t w_pending;
+} work_t;
+
+typedef struct delayed_work {
+  work_t dw_work;
+  timer_t dw_timer;
+  struct workqueue *dw_wq;
+} delayed_work_t;
+
+typedef struct workqueue workqueue_t;
+
+// System queues, one worker each. Created on first use so
+// workqueue_get() must be called from a thread (returns NULL if out
+// of memory)
+#define WORKQUEUE_LOW    0 // Priority 1
+#define WORKQUEUE_NORMAL 1 // Priority 4
+#define WORKQUEUE_HIGH   2 // Priority 8
+
+workqueue_t *workqueue_get(int band);
+
+workqueue_t *workqueue_create(const char *name, int workers, int prio,
+                              size_t stack_size, int flags,
+                              size_t max_queued);
+
+#define work_init(w, fn) do { (w)->w_fn = (fn); (w)->w_pending = 0; } while(0)
+
+void delayed_work_init(delayed_work_t *dw, void (*fn)(work_t *w));
+
+error_t work_submit(workqueue_t *wq, work_t *w);
+
+// Submit at (absolute) deadline. Rearms if already waiting
+void work_submit_delayed(workqueue_t *wq, delayed_work_t *dw,
+                         uint64_t deadline);
+
+// Returns 0 if removed from queue before it ran
+int work_cancel(workqueue_t *wq, work_t *w);
+
+int delayed_work_cancel(delayed_work_t *dw);
@@ -8,6 +8,8 @@ void *calloc(size_t nmemb, size_t size) __attribute__((malloc,warn_unused_result
 
 void free(void *ptr);
 
+void *realloc(void *ptr, size_t size) __attribute__((warn_unused_result));
+
 void *memalign(size_t size, size_t alignment) __attribute__((malloc,warn_unused_result));
 
 int atoi(const char *s);
@@ -22,4 +22,6 @@ NOFPU := -mgeneral-regs-only
 SRCS += ${C}/cpu.c \
 	${C}/exc.c \
 
+SRCS-${ENABLE_SMP} += ${C}/smp.c
+
 ${MOS}/cpu/aarch32/%.o : CFLAGS += ${NOFPU}
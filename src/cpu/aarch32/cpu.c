@@ -5,29 +5,46 @@
 
 #include <mios/timer.h>
 
+#ifdef ENABLE_SMP
+struct cpu cpus[CPU_MAX];
+#else
 struct cpu cpu0;
+#endif
 
-static void __attribute__((constructor(150)))
-cpu_init(void)
+
+thread_t *
+cpu_idle_thread_create(void)
 {
   const size_t stack_size = 128;
 
-  // Create idle task
   void *sp_bottom = xalloc(stack_size + sizeof(thread_t),
                            CPU_STACK_ALIGNMENT, 0);
   memset(sp_bottom, 0x55, stack_size + sizeof(thread_t));
   void *sp = sp_bottom + stack_size;
 
-  asm volatile ("cps #0x1f ; mov sp, %0; cps #0x13" : : "r" (sp));
-
   thread_t *t = sp;
   strlcpy(t->t_name, "idle", sizeof(t->t_name));
   t->t_sp_bottom = sp_bottom;
 
   t->t_task.t_state = TASK_STATE_ZOMBIE;
   t->t_task.t_prio = 0;
-  sched_cpu_init(&curcpu()->sched, t);
+  return t;
+}
+
 
+static void __attribute__((constructor(150)))
+cpu_init(void)
+{
+  // Create idle task
+  thread_t *t = cpu_idle_thread_create();
+
+  asm volatile ("cps #0x1f ; mov sp, %0; cps #0x13" : : "r" (t));
+
+  sched_cpu_init(&curcpu()->sched, t);
+#ifdef ENABLE_SMP
+  cpu_thread_current_set(t);
+  cpus_online = 1 << cpu_get_id();
+#endif
 }
 
 
@@ -9,12 +9,71 @@
 
 typedef struct cpu {
   sched_cpu_t sched;
+#ifdef ENABLE_SMP
+  uint32_t lock_depth; // Recursion depth of giant lock held by this CPU
+#endif
 } cpu_t;
 
+#ifdef ENABLE_SMP
+
+#ifndef CPU_MAX
+#define CPU_MAX 4
+#endif
+
+extern struct cpu cpus[CPU_MAX];
+
+extern uint32_t cpus_online; // Bitmask of CPUs taking part in scheduling
+
+static inline uint32_t
+cpu_get_id(void)
+{
+  uint32_t result;
+  asm volatile("mrc p15, 0, %0, c0, c0, 5" : "=r" (result));
+  return result & 3;
+}
+
+static inline struct cpu *curcpu(void) { return &cpus[cpu_get_id()]; }
+
+// The current thread is kept in TPIDRPRW so it can be read in a
+// single instruction without racing against migration to another CPU
+
+static inline thread_t *
+cpu_thread_current(void)
+{
+  thread_t *t;
+  asm volatile("mrc p15, 0, %0, c13, c0, 4" : "=r" (t));
+  return t;
+}
+
+static inline void
+cpu_thread_current_set(thread_t *t)
+{
+  asm volatile("mcr p15, 0, %0, c13, c0, 4" :: "r" (t));
+}
+
+// Raise a reschedule (SGI 0) on another CPU
+void cpu_kick(struct cpu *cpu);
+
+// Giant lock, acquired when a CPU transitions into an IRQ-masked
+// section and on IRQ entry. Must be called with IRQs disabled
+void smp_lock(void);
+
+void smp_unlock(void);
+
+// Bring up secondary CPUs, called by platform once it has prepared
+// whatever boot-monitor mailbox is needed
+void smp_init(void);
+
+extern void secondary_start(void);
+
+#else
+
 extern struct cpu cpu0;
 
 static inline struct cpu *curcpu(void) { return &cpu0; }
 
+#endif
+
 static inline void
 cpu_stack_redzone(thread_t *t)
 {
@@ -25,6 +84,7 @@ void *
 cpu_stack_init(uint32_t *stack, void *(*entry)(void *arg), void *arg,
                void (*thread_exit)(void *));
 
+thread_t *cpu_idle_thread_create(void);
 
 static inline uint32_t
 cpu_get_periphbase(void)
@@ -50,3 +110,17 @@ cpu_get_cpsr(void)
   asm("mrs %0, cpsr" : "=r" (result));
   return result;
 }
+
+
+// PC interrupted by the current IRQ. Must be called in IRQ mode. The
+// IRQ entry has pushed r0-r3, r12, lr and then the return PC and SPSR
+// to the interrupted (system mode) stack
+static inline uintptr_t
+cpu_interrupted_pc(void)
+{
+  const uint32_t *sp;
+  asm volatile("cps #0x1f\n"
+               "mov %0, sp\n"
+               "cps #0x12" : "=r" (sp));
+  return sp[6];
+}
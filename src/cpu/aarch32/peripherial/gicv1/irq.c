@@ -4,8 +4,10 @@
 #include "reg.h"
 
 #include <mios/mios.h>
+#include <mios/trace.h>
 
 #include <stdio.h>
+#include <malloc.h>
 
 
 struct irqentry {
@@ -15,6 +17,18 @@ struct irqentry {
 
 struct irqentry irqvector[96];
 
+#if defined(ENABLE_TRACE) || defined(ENABLE_IRQSTAT)
+#define IRQ_HOOK
+
+#define IRQ_HOOK_TRACE 0x1
+#define IRQ_HOOK_STAT  0x2
+
+// Table used by the IRQ handler in entry.S
+struct irqentry *irqvector_active = irqvector;
+static struct irqentry *irqvector_hook;
+static uint8_t hook_users;
+#endif
+
 void
 irq_enable(int irq, int level)
 {
@@ -26,6 +40,10 @@ irq_enable(int irq, int level)
   reg_wr(pbase + GICD_ICPENDR(reg), (1 << bit));
   reg_wr(pbase + GICD_ISENABLER(reg), (1 << bit));
   reg_wr8(pbase + GICD_IPRIORITYR(irq), IRQ_LEVEL_TO_PRI(level));
+  if(irq >= 32) {
+    // Shared peripheral interrupts are always routed to CPU 0
+    reg_wr8(pbase + GICD_ITARGETSR(irq), 1);
+  }
 }
 
 void
@@ -77,9 +95,95 @@ irq_init(void)
     irqvector[i].fn = (void *)spurious;
   }
 
-  reg_wr(pbase + ICCIPMR, 0xf8);
+  reg_wr(pbase + ICCIPMR, IRQ_PMR_UNMASKED);
   reg_wr(pbase + GICD_CTRL, 1);
   reg_wr(pbase + ICPICR, 1);
 
   irq_enable_fn(0, IRQ_LEVEL_SWITCH, cpu_task_switch);
 }
+
+#ifdef IRQ_HOOK
+
+static void
+irq_hook_dispatch(void *arg)
+{
+  const int irq = (intptr_t)arg;
+  const struct irqentry *ie = &irqvector[irq];
+#ifdef ENABLE_IRQSTAT
+  const uint32_t latency = irq == GT_IRQ ? systick_irq_latency() : 0;
+  const uint32_t start = irqstat_now();
+#endif
+#ifdef ENABLE_TRACE
+  if(hook_users & IRQ_HOOK_TRACE)
+    trace_record(TRACE_IRQ_ENTER, irq, NULL, NULL);
+#endif
+
+  ie->fn(ie->arg);
+
+#ifdef ENABLE_TRACE
+  if(hook_users & IRQ_HOOK_TRACE)
+    trace_record(TRACE_IRQ_EXIT, irq, NULL, NULL);
+#endif
+#ifdef ENABLE_IRQSTAT
+  if(hook_users & IRQ_HOOK_STAT) {
+    irqstat_irq(irq, irqstat_now() - start);
+    if(irq == GT_IRQ)
+      irqstat_irq_latency(latency);
+  }
+#endif
+}
+
+
+static void
+irq_hook_set(int user, int on)
+{
+  if(irqvector_hook == NULL) {
+    irqvector_hook = xalloc(sizeof(irqvector), 0, 0);
+    // SGI 0 (task switch) must be called directly from entry.S
+    irqvector_hook[0] = irqvector[0];
+    for(size_t i = 1; i < ARRAYSIZE(irqvector); i++) {
+      irqvector_hook[i].fn = irq_hook_dispatch;
+      irqvector_hook[i].arg = (void *)i;
+    }
+  }
+
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  if(on)
+    hook_users |= user;
+  else
+    hook_users &= ~user;
+  __atomic_store_n(&irqvector_active, hook_users ? irqvector_hook : irqvector,
+                   __ATOMIC_SEQ_CST);
+  irq_permit(q);
+}
+
+#endif
+
+#ifdef ENABLE_TRACE
+void
+irq_trace_enable(int on)
+{
+  irq_hook_set(IRQ_HOOK_TRACE, on);
+}
+#endif
+
+#ifdef ENABLE_IRQSTAT
+void
+irq_stat_enable(int on)
+{
+  irq_hook_set(IRQ_HOOK_STAT, on);
+}
+#endif
+
+#ifdef ENABLE_SMP
+void
+irq_init_secondary(void)
+{
+  uint32_t pbase = cpu_get_periphbase();
+
+  // CPU interface and SGI/PPI enables are banked per CPU
+  reg_wr(pbase + ICCIPMR, IRQ_PMR_UNMASKED);
+  reg_wr(pbase + ICPICR, 1);
+  irq_enable(0, IRQ_LEVEL_SWITCH);
+}
+#endif
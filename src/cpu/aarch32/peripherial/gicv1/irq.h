@@ -3,6 +3,8 @@
 #include "cpu.h"
 #include "reg.h"
 
+#include <mios/irqstat.h>
+
 #define IRQ_LEVEL_ALL      1
 #define IRQ_LEVEL_HIGH     1
 
@@ -23,6 +25,8 @@
 
 #define IRQ_LEVEL_TO_PRI(x) ((x) << IRQ_PRI_LEVEL_SHIFT)
 
+#define IRQ_PMR_UNMASKED 0xf8
+
 void irq_enable(int irq, int level);
 
 void irq_enable_fn_arg(int irq, int level, void (*fn)(void *arg), void *arg);
@@ -31,6 +35,40 @@ void irq_enable_fn(int irq, int level, void (*fn)(void));
 
 void irq_disable(int irq);
 
+#ifdef ENABLE_TRACE
+void irq_trace_enable(int on);
+#endif
+
+#define GT_IRQ 27 // Global timer, clock source
+
+#ifdef ENABLE_IRQSTAT
+
+#define HAVE_IRQSTAT
+
+#define IRQSTAT_VECTORS 96
+#define IRQSTAT_VECTOR_IRQ(v) (v)
+#define IRQSTAT_UNIT "timer ticks"
+
+// Global timer, low word
+static inline uint32_t
+irqstat_now(void)
+{
+  return reg_rd(cpu_get_periphbase() + 0x200);
+}
+
+void irq_stat_enable(int on);
+
+// Ticks since the global timer comparator fired
+uint32_t systick_irq_latency(void);
+
+#endif
+
+#ifdef ENABLE_SMP
+void irq_init_secondary(void);
+
+void systick_init_secondary(void);
+#endif
+
 
 #define ICPICR     0x100
 #define ICCIPMR    0x104
@@ -66,17 +104,84 @@ irq_forbid(unsigned int level)
   if(pri < pmr) {
     reg_wr(pbase + ICCIPMR, pri);
     asm volatile("isb" ::: "memory");
+    if(pmr == IRQ_PMR_UNMASKED) {
+#ifdef ENABLE_SMP
+      smp_lock();
+#endif
+      irqstat_mask_event(irqstat_mask_begin);
+    }
   }
   asm volatile ("msr cpsr, %0\n\r" :: "r" (cpsr));
   return pmr;
 }
 
+#ifdef ENABLE_SMP
+
+/*
+ * On SMP the giant lock is held whenever the PMR masks anything, so
+ * a change of PMR across the unmasked boundary also moves the lock
+ */
+
+__attribute__((always_inline))
+static inline void
+irq_permit(unsigned int old)
+{
+  uint32_t cpsr;
+  uint32_t pbase = cpu_get_periphbase();
+
+  asm volatile ("mrs %0, cpsr\n\t" : "=r" (cpsr));
+  asm volatile ("msr cpsr, %0\n\r" :: "r" (cpsr | 0x80));
+
+  uint32_t pmr = reg_rd(pbase + ICCIPMR);
+  if(pmr == IRQ_PMR_UNMASKED && old != IRQ_PMR_UNMASKED) {
+    smp_lock();
+    irqstat_mask_event(irqstat_mask_begin);
+  } else if(pmr != IRQ_PMR_UNMASKED && old == IRQ_PMR_UNMASKED) {
+    irqstat_mask_event(irqstat_mask_end);
+    smp_unlock();
+  }
+  reg_wr(pbase + ICCIPMR, old);
+  asm volatile ("msr cpsr, %0\n\r" :: "r" (cpsr));
+}
+
+__attribute__((always_inline))
+static inline unsigned int
+irq_lower(void)
+{
+  uint32_t cpsr;
+  uint32_t pbase = cpu_get_periphbase();
+
+  asm volatile ("mrs %0, cpsr\n\t" : "=r" (cpsr));
+  asm volatile ("msr cpsr, %0\n\r" :: "r" (cpsr | 0x80));
+
+  uint32_t old = reg_rd(pbase + ICCIPMR);
+  if(old != IRQ_PMR_UNMASKED) {
+    irqstat_mask_event(irqstat_mask_end);
+    smp_unlock();
+  }
+  reg_wr(pbase + ICCIPMR, IRQ_PMR_UNMASKED);
+  asm volatile("isb" ::: "memory");
+  asm volatile ("msr cpsr, %0\n\r" :: "r" (cpsr));
+  return old;
+}
+
+#else
+
 __attribute__((always_inline))
 static inline void
 irq_permit(unsigned int old)
 {
   uint32_t pbase = cpu_get_periphbase();
+#ifdef ENABLE_IRQSTAT
+  const uint32_t pmr = reg_rd(pbase + ICCIPMR);
+  if(pmr != IRQ_PMR_UNMASKED && old == IRQ_PMR_UNMASKED)
+    irqstat_mask_event(irqstat_mask_end);
+#endif
   reg_wr(pbase + ICCIPMR, old);
+#ifdef ENABLE_IRQSTAT
+  if(pmr == IRQ_PMR_UNMASKED && old != IRQ_PMR_UNMASKED)
+    irqstat_mask_event(irqstat_mask_begin);
+#endif
 }
 
 __attribute__((always_inline))
@@ -85,11 +190,15 @@ irq_lower(void)
 {
   uint32_t pbase = cpu_get_periphbase();
   uint32_t old = reg_rd(pbase + ICCIPMR);
-  reg_wr(pbase + ICCIPMR, 0xf8);
+  if(old != IRQ_PMR_UNMASKED)
+    irqstat_mask_event(irqstat_mask_end);
+  reg_wr(pbase + ICCIPMR, IRQ_PMR_UNMASKED);
   asm volatile("isb" ::: "memory");
   return old;
 }
 
+#endif
+
 __attribute__((always_inline))
 static inline void
 schedule(void)
@@ -104,5 +213,5 @@ static inline int
 can_sleep(void)
 {
   uint32_t pbase = cpu_get_periphbase();
-  return reg_rd(pbase + ICCRPR) >= 0xf8 && ((cpu_get_cpsr() & 0x1f) == 0x1f);
+  return reg_rd(pbase + ICCRPR) >= IRQ_PMR_UNMASKED && ((cpu_get_cpsr() & 0x1f) == 0x1f);
 }
@@ -9,72 +9,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define PTLOAD   0x600
-#define PTCNTR   0x604
-#define PTCTRL   0x608
-#define PTSTATUS 0x60c
+// Cortex-A9 global timer. The counter is shared by all CPUs which
+// keeps the clock monotonic across them. Comparator is banked per CPU
+
+#define GTCNTLO  0x200
+#define GTCNTHI  0x204
+#define GTCTRL   0x208
+#define GTSTATUS 0x20c
+#define GTCMPLO  0x210
+#define GTCMPHI  0x214
+#define GTAUTOINC 0x218
+
+#define GTCTRL_ENABLE   0x1
+#define GTCTRL_COMP     0x2
+#define GTCTRL_IRQ      0x4
+#define GTCTRL_AUTOINC  0x8
 
 #define HZ 100
 #define TICKS_PER_US ((CPU_TIMER_CLOCK + 999999) / 1000000)
 #define TICKS_PER_HZ ((CPU_TIMER_CLOCK + HZ - 1) / HZ)
 
+// Don't program a deadline closer than this as we might miss it
+#define TICKLESS_MIN_TICKS (TICKS_PER_US * 5)
 
 static struct timer_list timers;
 
-uint64_t clock;
-
-static void
-tick_irq(void)
+static uint64_t
+gt_read(uint32_t pbase)
 {
-  uint32_t pbase = cpu_get_periphbase();
-  int ev = reg_rd(pbase + PTSTATUS);
-  if(ev & 1) {
-    clock += 1000000 / HZ;
-    reg_wr(pbase + PTSTATUS, 1);
+  while(1) {
+    uint32_t hi = reg_rd(pbase + GTCNTHI);
+    uint32_t lo = reg_rd(pbase + GTCNTLO);
+    if(likely(hi == reg_rd(pbase + GTCNTHI)))
+      return ((uint64_t)hi << 32) | lo;
   }
-
-  const uint64_t now = clock;
-  timer_dispatch(&timers, now);
 }
 
+
 uint64_t
 clock_get_irq_blocked(void)
+{
+  return gt_read(cpu_get_periphbase()) / TICKS_PER_US;
+}
+
+
+#ifdef ENABLE_TICKLESS
+
+static int in_dispatch;
+static uint64_t tickless_deadline = UINT64_MAX;
+
+static void
+tickless_program(void)
 {
   uint32_t pbase = cpu_get_periphbase();
+  tickless_deadline = timer_next(&timers);
 
-  while(1) {
-    uint32_t v = reg_rd(pbase + PTCNTR);
-    uint32_t remain = v / TICKS_PER_US;
-    uint64_t c = clock;
-
-    c += (1000000 / HZ) - remain;
-
-    if(unlikely(reg_rd(pbase + PTSTATUS))) {
-      clock += 1000000 / HZ;
-      reg_wr(pbase + PTSTATUS, 1);
-      continue;
-    }
-    return c;
-  }
+  reg_wr(pbase + GTCTRL, GTCTRL_ENABLE);
+  reg_wr(pbase + GTSTATUS, 1);
+  if(tickless_deadline == UINT64_MAX)
+    return;
+
+  uint64_t cmp = tickless_deadline * TICKS_PER_US;
+  const uint64_t min = gt_read(pbase) + TICKLESS_MIN_TICKS;
+  if(cmp < min)
+    cmp = min;
 
-  return 0;
+  reg_wr(pbase + GTCMPLO, cmp);
+  reg_wr(pbase + GTCMPHI, cmp >> 32);
+  reg_wr(pbase + GTCTRL, GTCTRL_ENABLE | GTCTRL_COMP | GTCTRL_IRQ);
 }
 
+#endif
 
-uint64_t
-clock_get(void)
+
+static void
+tick_irq(void)
 {
-  int s = irq_forbid(IRQ_LEVEL_CLOCK);
-  uint64_t r = clock_get_irq_blocked();
-  irq_permit(s);
-  return r;
+  uint32_t pbase = cpu_get_periphbase();
+  reg_wr(pbase + GTSTATUS, 1);
+
+  const uint64_t now = clock_get_irq_blocked();
+#ifdef ENABLE_TICKLESS
+  in_dispatch = 1;
+  timer_dispatch(&timers, now);
+  in_dispatch = 0;
+  tickless_program();
+#else
+  timer_dispatch(&timers, now);
+#endif
 }
 
 
-static int
-timer_cmp(const timer_t *a, const timer_t *b)
+// The global timer is read without side effects so there is no need
+// to block IRQ_LEVEL_CLOCK (which takes the giant lock on SMP)
+uint64_t
+clock_get(void)
 {
-  return a->t_expire > b->t_expire;
+  return clock_get_irq_blocked();
 }
 
 
@@ -83,12 +114,11 @@ __attribute__((weak))
 void
 timer_arm_abs(timer_t *t, uint64_t expire)
 {
-  if(t->t_expire)
-    LIST_REMOVE(t, t_link);
-
-  t->t_expire = expire;
-
-  LIST_INSERT_SORTED(&timers, t, t_link, timer_cmp);
+  timer_arm_on_queue(t, expire, &timers);
+#ifdef ENABLE_TICKLESS
+  if(expire < tickless_deadline && !in_dispatch)
+    tickless_program();
+#endif
 }
 
 
@@ -97,11 +127,47 @@ static void  __attribute__((constructor(122)))
 systick_init(void)
 {
   uint32_t pbase = cpu_get_periphbase();
-  reg_wr(pbase + PTLOAD, TICKS_PER_HZ);
-  reg_wr(pbase + PTCTRL, 0b111);
-  irq_enable_fn(29, IRQ_LEVEL_CLOCK, tick_irq);
+  reg_wr(pbase + GTCTRL, 0);
+  reg_wr(pbase + GTCNTLO, 0);
+  reg_wr(pbase + GTCNTHI, 0);
+  reg_wr(pbase + GTSTATUS, 1);
+#ifdef ENABLE_TICKLESS
+  reg_wr(pbase + GTCTRL, GTCTRL_ENABLE);
+#else
+  reg_wr(pbase + GTCMPLO, TICKS_PER_HZ);
+  reg_wr(pbase + GTCMPHI, 0);
+  reg_wr(pbase + GTAUTOINC, TICKS_PER_HZ);
+  reg_wr(pbase + GTCTRL,
+         GTCTRL_ENABLE | GTCTRL_COMP | GTCTRL_IRQ | GTCTRL_AUTOINC);
+#endif
+  irq_enable_fn(GT_IRQ, IRQ_LEVEL_CLOCK, tick_irq);
+}
+
+
+#ifdef ENABLE_IRQSTAT
+uint32_t
+systick_irq_latency(void)
+{
+  uint32_t pbase = cpu_get_periphbase();
+  uint32_t cmp = reg_rd(pbase + GTCMPLO);
+#ifndef ENABLE_TICKLESS
+  // Comparator has already been autoincremented to the next period
+  cmp -= TICKS_PER_HZ;
+#endif
+  return reg_rd(pbase + GTCNTLO) - cmp;
 }
+#endif
+
 
+#ifdef ENABLE_SMP
+void
+systick_init_secondary(void)
+{
+  // Timer interrupt is a banked PPI. In tickless mode the comparator
+  // is programmed by whatever CPU arms the first timer
+  irq_enable(GT_IRQ, IRQ_LEVEL_CLOCK);
+}
+#endif
 
 
 // XXX: This is a bad PRNG as it only uses the systick timer as source
@@ -112,6 +178,6 @@ rand(void)
   static prng_t state;
 
   uint32_t pbase = cpu_get_periphbase();
-  uint32_t src = reg_rd(pbase + PTCNTR);
+  uint32_t src = reg_rd(pbase + GTCNTLO);
   return prng_get(&state, src) & RAND_MAX;
 }
@@ -0,0 +1,128 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <mios/mios.h>
+
+#include "cpu.h"
+#include "irq.h"
+#include "reg.h"
+
+#define SCU_CONFIG 0x4
+
+#define EXC_STACK_SIZE 1024
+
+uint32_t cpus_online;
+
+static uint32_t giant_lock;
+
+// Read by secondary_start in entry.S
+volatile uint32_t smp_boot_cpu;
+uint32_t smp_boot_stacks[3]; // IRQ, ABT, SVC stack tops
+
+
+void
+smp_lock(void)
+{
+  cpu_t *cpu = curcpu();
+  if(cpu->lock_depth++)
+    return;
+
+  while(__atomic_exchange_n(&giant_lock, 1, __ATOMIC_ACQUIRE)) {
+    asm volatile("wfe");
+  }
+}
+
+
+void
+smp_unlock(void)
+{
+  cpu_t *cpu = curcpu();
+  if(--cpu->lock_depth)
+    return;
+
+  __atomic_store_n(&giant_lock, 0, __ATOMIC_RELEASE);
+  asm volatile("dsb\n\tsev" ::: "memory");
+}
+
+
+void
+cpu_kick(struct cpu *cpu)
+{
+  uint32_t pbase = cpu_get_periphbase();
+  reg_wr(pbase + GICD_SGIR, 1 << (16 + (cpu - cpus)));
+}
+
+
+static void
+cpu_set_smp_mode(void)
+{
+  uint32_t actlr;
+  asm volatile("mrc p15, 0, %0, c1, c0, 1" : "=r" (actlr));
+  actlr |= 1 << 6; // Take part in coherency
+  asm volatile("mcr p15, 0, %0, c1, c0, 1" :: "r" (actlr));
+}
+
+
+void *
+smp_secondary_init(void)
+{
+  cpu_t *cpu = curcpu();
+
+  cpu_set_smp_mode();
+  irq_init_secondary();
+  systick_init_secondary();
+
+  thread_t *idle = cpu->sched.current;
+  cpu_thread_current_set(idle);
+
+  __atomic_or_fetch(&cpus_online, 1 << cpu_get_id(), __ATOMIC_SEQ_CST);
+  asm volatile("sev");
+  return idle;
+}
+
+
+static int
+smp_start_cpu(uint32_t id)
+{
+  cpu_t *cpu = &cpus[id];
+
+  // Everything the secondary needs is allocated here as it can't
+  // take any locks until it's online
+  sched_cpu_init(&cpu->sched, cpu_idle_thread_create());
+
+  for(int i = 0; i < 3; i++) {
+    void *stack = xalloc(EXC_STACK_SIZE, CPU_STACK_ALIGNMENT, 0);
+    smp_boot_stacks[i] = (uint32_t)stack + EXC_STACK_SIZE;
+  }
+
+  asm volatile("dsb" ::: "memory");
+  smp_boot_cpu = id;
+  asm volatile("dsb\n\tsev" ::: "memory");
+  cpu_kick(cpu); // In case it's sitting in wfi in a boot monitor
+
+  const uint64_t deadline = clock_get_irq_blocked() + 100000;
+  while(!(__atomic_load_n(&cpus_online, __ATOMIC_SEQ_CST) & (1 << id))) {
+    if(clock_get_irq_blocked() > deadline)
+      return -1;
+  }
+  return 0;
+}
+
+
+void
+smp_init(void)
+{
+  uint32_t pbase = cpu_get_periphbase();
+  uint32_t num_cpus = (reg_rd(pbase + SCU_CONFIG) & 3) + 1;
+  if(num_cpus > CPU_MAX)
+    num_cpus = CPU_MAX;
+
+  cpu_set_smp_mode();
+
+  for(uint32_t i = 1; i < num_cpus; i++) {
+    if(smp_start_cpu(i))
+      printf("cpu%d: Failed to start\n", i);
+  }
+  smp_boot_cpu = 0;
+}
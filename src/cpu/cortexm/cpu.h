@@ -46,3 +46,20 @@ cpu_cycle_counter(void)
   volatile unsigned int *DWT_CYCCNT   = (volatile unsigned int *)0xE0001004;
   return *DWT_CYCCNT;
 }
+
+
+// PC of the thread interrupted by the current exception or 0 if
+// another exception was preempted (ARMv6-M can't tell, so there it's
+// the PC last stacked by the thread)
+static inline uintptr_t
+cpu_interrupted_pc(void)
+{
+#ifndef __ARM_ARCH_6M__
+  static volatile unsigned int * const ICSR = (unsigned int *)0xe000ed04;
+  if(!(*ICSR & (1 << 11))) // RETTOBASE
+    return 0;
+#endif
+  const uint32_t *psp;
+  asm volatile ("mrs %0, psp" : "=r" (psp));
+  return psp[6];
+}
@@ -4,6 +4,7 @@
 #include <malloc.h>
 #include <string.h>
 #include <mios/mios.h>
+#include <mios/trace.h>
 #include "irq.h"
 
 static volatile unsigned int * const ICSR    = (unsigned int *)0xe000ed04;
@@ -46,23 +47,46 @@ irq_disable(int irq)
 }
 
 
-void
-irq_enable_fn(int irq, int level, void (*fn)(void))
-{
-  assert(irq < CORTEXM_IRQ_COUNT);
-  int q = irq_forbid(IRQ_LEVEL_ALL);
+#define VECTORS_SIZE ((16 + CORTEXM_IRQ_COUNT) * sizeof(void *))
+
+#if defined(ENABLE_TRACE) || defined(HAVE_IRQSTAT)
+#define IRQ_HOOK
+
+#define IRQ_HOOK_TRACE 0x1
+#define IRQ_HOOK_STAT  0x2
 
+static uint32_t *hook_vectors;
+static uint32_t *hook_orig_vectors;
+static uint8_t hook_users;
+#endif
+
+// IRQ_LEVEL_ALL must be blocked
+static uint32_t *
+irq_vectors_writable(void)
+{
   uint32_t curvecs = *VTOR;
 
   if(curvecs == (uint32_t)&vectors) {
     // Not yet relocated
-    const size_t vecsize = (16 + CORTEXM_IRQ_COUNT) * sizeof(void *);
-    void *p = xalloc(vecsize, 0x200, 0);
-    memcpy(p, &vectors, vecsize);
+    void *p = xalloc(VECTORS_SIZE, 0x200, 0);
+    memcpy(p, &vectors, VECTORS_SIZE);
     *VTOR = (uint32_t)p;
   }
+#ifdef IRQ_HOOK
+  if(*VTOR == (uint32_t)hook_vectors)
+    return hook_orig_vectors;
+#endif
+  return (uint32_t *)*VTOR;
+}
+
+
+void
+irq_enable_fn(int irq, int level, void (*fn)(void))
+{
+  assert(irq < CORTEXM_IRQ_COUNT);
+  int q = irq_forbid(IRQ_LEVEL_ALL);
 
-  uint32_t *vtable = (uint32_t *)*VTOR;
+  uint32_t *vtable = irq_vectors_writable();
   vtable[irq + 16] = (uint32_t)fn;
 #ifdef HAVE_BASEPRI
   NVIC_IPR[irq] = IRQ_LEVEL_TO_PRI(level);
@@ -133,6 +157,98 @@ irq_enable_fn_arg(int irq, int level, void (*fn)(void *arg), void *arg)
   irq_enable_fn(irq, level, (void *)p + 1);
 }
 
+#ifdef IRQ_HOOK
+
+#ifdef HAVE_IRQSTAT
+static volatile unsigned int * const SYST_RVR = (unsigned int *)0xe000e014;
+static volatile unsigned int * const SYST_VAL = (unsigned int *)0xe000e018;
+
+static volatile uint32_t *const DWT_CONTROL = (volatile uint32_t *)0xE0001000;
+static volatile uint32_t *const DWT_LAR     = (volatile uint32_t *)0xE0001FB0;
+static volatile uint32_t *const SCB_DEMCR   = (volatile uint32_t *)0xE000EDFC;
+#endif
+
+static void
+irq_hook_trampoline(void)
+{
+  const int vec = *ICSR & 0x1ff;
+#ifdef HAVE_IRQSTAT
+  // SysTick counts CPU cycles down from RVR since it fired
+  const uint32_t latency = vec == 15 ? *SYST_RVR - *SYST_VAL : 0;
+  const uint32_t start = irqstat_now();
+#endif
+#ifdef ENABLE_TRACE
+  if(hook_users & IRQ_HOOK_TRACE)
+    trace_record(TRACE_IRQ_ENTER, vec - 16, NULL, NULL);
+#endif
+
+  ((void (*)(void))hook_orig_vectors[vec])();
+
+#ifdef ENABLE_TRACE
+  if(hook_users & IRQ_HOOK_TRACE)
+    trace_record(TRACE_IRQ_EXIT, vec - 16, NULL, NULL);
+#endif
+#ifdef HAVE_IRQSTAT
+  if(hook_users & IRQ_HOOK_STAT) {
+    irqstat_irq(vec, irqstat_now() - start);
+    if(vec == 15)
+      irqstat_irq_latency(latency);
+  }
+#endif
+}
+
+
+// Route SysTick and all IRQs via irq_hook_trampoline() by switching
+// to a vector table of our own. No cost at all when not hooked
+static void
+irq_hook_set(int user, int on)
+{
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  uint32_t *orig = irq_vectors_writable();
+
+  if(on)
+    hook_users |= user;
+  else
+    hook_users &= ~user;
+
+  if(hook_users) {
+    if(hook_vectors == NULL)
+      hook_vectors = xalloc(VECTORS_SIZE, 0x200, 0);
+    hook_orig_vectors = orig;
+    memcpy(hook_vectors, orig, 15 * sizeof(void *));
+    for(int i = 15; i < 16 + CORTEXM_IRQ_COUNT; i++)
+      hook_vectors[i] = (uint32_t)irq_hook_trampoline;
+    *VTOR = (uint32_t)hook_vectors;
+  } else {
+    *VTOR = (uint32_t)orig;
+  }
+  irq_permit(q);
+}
+
+#endif
+
+#ifdef ENABLE_TRACE
+void
+irq_trace_enable(int on)
+{
+  irq_hook_set(IRQ_HOOK_TRACE, on);
+}
+#endif
+
+#ifdef HAVE_IRQSTAT
+void
+irq_stat_enable(int on)
+{
+  if(on) {
+    // Enable cycle counter
+    *SCB_DEMCR |= 0x01000000;
+    *DWT_LAR = 0xC5ACCE55; // unlock
+    *DWT_CONTROL |= 1;
+  }
+  irq_hook_set(IRQ_HOOK_STAT, on);
+}
+#endif
+
 static void __attribute__((constructor(101)))
 irq_init(void)
 {
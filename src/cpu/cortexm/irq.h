@@ -21,6 +21,7 @@
 #define IRQ_LEVEL_TO_PRI(x) ((x) << IRQ_PRI_LEVEL_SHIFT)
 
 #include <mios/mios.h>
+#include <mios/irqstat.h>
 
 #ifdef HAVE_BASEPRI
 
@@ -54,13 +55,25 @@ irq_forbid(unsigned int level)
   unsigned int old;
   asm volatile ("mrs %0, basepri\n\t" : "=r" (old));
   asm volatile ("msr basepri_max, %0\n\t" : : "r" (IRQ_LEVEL_TO_PRI(level)));
+  if(!old)
+    irqstat_mask_event(irqstat_mask_begin);
   return old;
 }
 
 inline void  __attribute__((always_inline))
 irq_permit(unsigned int pri)
 {
+#ifdef ENABLE_IRQSTAT
+  unsigned int cur;
+  asm volatile ("mrs %0, basepri\n\t" : "=r" (cur));
+  if(!pri && cur)
+    irqstat_mask_event(irqstat_mask_end);
+#endif
   asm volatile ("msr basepri, %0\n\t" : : "r" (pri));
+#ifdef ENABLE_IRQSTAT
+  if(pri && !cur)
+    irqstat_mask_event(irqstat_mask_begin);
+#endif
 }
 
 
@@ -69,6 +82,8 @@ irq_lower(void)
 {
   unsigned int old;
   asm volatile ("mrs %0, basepri\n\t" : "=r" (old));
+  if(old)
+    irqstat_mask_event(irqstat_mask_end);
   asm volatile ("msr basepri, %0\n\t" : : "r" (0));
   return old;
 }
@@ -166,6 +181,30 @@ void irq_enable_fn_fpu(int irq, int level, void (*fn)(void *arg), void *arg);
 
 void irq_disable(int irq);
 
+#ifdef ENABLE_TRACE
+void irq_trace_enable(int on);
+#endif
+
+#if defined(ENABLE_IRQSTAT) && defined(HAVE_BASEPRI)
+
+// ARMv6-M has neither BASEPRI nor a cycle counter
+#define HAVE_IRQSTAT
+
+#define IRQSTAT_VECTORS (16 + CORTEXM_IRQ_COUNT) // Exception numbers
+#define IRQSTAT_VECTOR_IRQ(v) ((v) - 16) // -1 is SysTick
+#define IRQSTAT_UNIT "cycles"
+
+static inline uint32_t
+irqstat_now(void)
+{
+  volatile unsigned int *DWT_CYCCNT   = (volatile unsigned int *)0xE0001004;
+  return *DWT_CYCCNT;
+}
+
+void irq_stat_enable(int on);
+
+#endif
+
 inline void  __attribute__((always_inline))
 irq_ack(int irq)
 {
@@ -17,11 +17,120 @@ static struct timer_list timers;
 
 uint64_t clock;
 
+#ifdef ENABLE_TICKLESS
+
+// Don't program a period shorter than this as we might miss it
+#define TICKLESS_MIN_TICKS (TICKS_PER_US * 5)
+#define TICKLESS_MAX_TICKS 0x1000000
+
+uint32_t systick_period = TICKLESS_MAX_TICKS;
+uint32_t systick_frac;
+
+static int in_dispatch;
+static uint64_t systick_deadline = UINT64_MAX;
+
+// Ticks elapsed in current period, any pending wrap is accounted for
+static uint32_t
+systick_elapsed(void)
+{
+  while(1) {
+    uint32_t v = *SYST_VAL;
+    if(unlikely(*SYST_CSR & 0x10000)) {
+      // Reload has already happened so RVR is what we're counting now
+      systick_frac += systick_period;
+      systick_period = *SYST_RVR + 1;
+      continue;
+    }
+    return v ? systick_period - v : 0;
+  }
+}
+
+
+uint64_t
+clock_get_irq_blocked(void)
+{
+  const uint32_t elapsed = systick_elapsed();
+  clock += systick_frac / TICKS_PER_US;
+  systick_frac %= TICKS_PER_US;
+  return clock + (systick_frac + elapsed) / TICKS_PER_US;
+}
+
+
+// Restart the counter with a period ending at the first timer deadline
+static void
+systick_program(void)
+{
+  systick_deadline = timer_next(&timers);
+  uint32_t ticks = TICKLESS_MAX_TICKS;
+  if(systick_deadline != UINT64_MAX) {
+    const int64_t delta = systick_deadline - clock_get_irq_blocked();
+    if(delta < TICKLESS_MAX_TICKS / TICKS_PER_US)
+      ticks = delta > TICKLESS_MIN_TICKS / TICKS_PER_US ?
+        delta * TICKS_PER_US : TICKLESS_MIN_TICKS;
+  }
+
+  // A wrap between here and the restart picks up the new RVR, which
+  // systick_elapsed() knows about
+  *SYST_RVR = ticks - 1;
+
+  // Read VAL, clear it and read it again back-to-back. The ticks from
+  // the first read to the clear are not seen by the counter, but take
+  // as long as from the clear to the second read, which is seen
+  const int s = irq_forbid(IRQ_LEVEL_ALL);
+  const uint32_t before = systick_elapsed();
+  uint32_t v1, v2;
+  asm volatile("ldr %0, [%2]\n\t"
+               "str %3, [%2]\n\t"
+               "ldr %1, [%2]"
+               : "=&r"(v1), "=&r"(v2)
+               : "r"(SYST_VAL), "r"(0)
+               : "memory");
+  irq_permit(s);
+
+  // VAL is 0 either right after a previous restart or at the end of
+  // the period
+  uint32_t elapsed = v1 ? systick_period - v1 : before ? systick_period : 0;
+  if(elapsed < before) {
+    // Wrapped just after systick_elapsed(), into a period of ticks
+    systick_frac += systick_period;
+    elapsed = ticks - v1;
+  }
+  const uint32_t lost = v2 ? ticks - v2 : 0;
+
+  systick_frac += elapsed + lost;
+  systick_period = ticks;
+}
+
+
+void
+exc_systick(void)
+{
+  const uint64_t now = clock_get_irq_blocked();
+  in_dispatch = 1;
+  timer_dispatch(&timers, now);
+  in_dispatch = 0;
+  systick_program();
+}
+
+#else
+
+// Lets clock_get() read clock without blocking IRQ_LEVEL_CLOCK
+seqlock_t clock_seq;
+
+static void
+clock_advance(void)
+{
+  seqlock_write_begin(&clock_seq);
+  clock += 1000000 / HZ;
+  seqlock_write_end(&clock_seq);
+}
+
+
 void
 exc_systick(void)
 {
   if(likely(*SYST_CSR & 0x10000)) {
-    clock += 1000000 / HZ;
+    clock_advance();
   }
 
   const uint64_t now = clock;
@@ -40,36 +149,47 @@ clock_get_irq_blocked(void)
     c += (1000000 / HZ) - remain;
 
     if(unlikely(*SYST_CSR & 0x10000)) {
-      clock += 1000000 / HZ;
+      clock_advance();
       continue;
     }
     return c;
   }
 }
 
-static int
-timer_cmp(const timer_t *a, const timer_t *b)
-{
-  return a->t_expire > b->t_expire;
-}
+#endif
 
 // IRQ_LEVEL_CLOCK must be blocked
 __attribute__((weak))
 void
 timer_arm_abs(timer_t *t, uint64_t expire)
 {
-  if(t->t_expire)
-    LIST_REMOVE(t, t_link);
-
-  t->t_expire = expire;
-
-  LIST_INSERT_SORTED(&timers, t, t_link, timer_cmp);
+  timer_arm_on_queue(t, expire, &timers);
+#ifdef ENABLE_TICKLESS
+  if(expire < systick_deadline && !in_dispatch)
+    systick_program();
+#endif
 }
 
 
 uint64_t
 clock_get(void)
 {
+#if !defined(ENABLE_TICKLESS) && !defined(__ARM_ARCH_6M__)
+  // COUNTFLAG is cleared when read so we can't look at it here. If
+  // SysTick is pending, or active (PENDSTSET clears on entry, and the
+  // handler may be preempted before it has advanced the clock), a wrap
+  // might not be accounted for yet, so take the slow path. ARMv6-M
+  // can't tell if SysTick is active and always takes the slow path
+  static volatile unsigned int * const ICSR = (unsigned int *)0xe000ed04;
+  static volatile unsigned int * const SHCSR = (unsigned int *)0xe000ed24;
+  const uint32_t seq = seqlock_read_begin(&clock_seq);
+  const uint64_t c = clock;
+  const uint32_t v = *SYST_VAL;
+  if(likely(!(*ICSR & (1 << 26)) && !(*SHCSR & (1 << 11)) &&
+            !seqlock_read_retry(&clock_seq, seq)))
+    return c + (1000000 / HZ) - v / TICKS_PER_US;
+#endif
+
   int s = irq_forbid(IRQ_LEVEL_CLOCK);
   uint64_t r = clock_get_irq_blocked();
   irq_permit(s);
@@ -90,7 +210,11 @@ udelay(unsigned int usec)
 static void __attribute__((constructor(130)))
 systick_init(void)
 {
+#ifdef ENABLE_TICKLESS
+  *SYST_RVR = TICKLESS_MAX_TICKS - 1;
+#else
   *SYST_RVR = TICKS_PER_HZ;
+#endif
   *SYST_VAL = 0;
   *SYST_CSR = 7;
 }
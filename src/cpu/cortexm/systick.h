@@ -1,17 +1,35 @@
 #pragma once
 
 #include <mios/mios.h>
+#include <mios/seqlock.h>
 
 #define HZ 100
 #define TICKS_PER_US ((CPU_SYSTICK_RVR + 999999) / 1000000)
 #define TICKS_PER_HZ ((CPU_SYSTICK_RVR + HZ - 1) / HZ)
 
+#ifdef ENABLE_TICKLESS
+extern uint32_t systick_period; // Length of current SysTick period
+extern uint32_t systick_frac;   // Ticks not yet accounted for in clock
+#endif
+
 static inline __attribute__((always_inline)) int clock_unwrap(void)
 {
-  extern uint64_t clock;
   static volatile unsigned int * const SYST_CSR = (unsigned int *)0xe000e010;
   if(unlikely(*SYST_CSR & 0x10000)) {
+#ifdef ENABLE_TICKLESS
+    // Callers may run from RAM so don't divide here. Fall back to
+    // 1/HZ periods as callers count wraps for timeouts
+    static volatile unsigned int * const SYST_RVR = (unsigned int *)0xe000e014;
+    systick_frac += systick_period;
+    systick_period = *SYST_RVR + 1;
+    *SYST_RVR = TICKS_PER_HZ - 1;
+#else
+    extern uint64_t clock;
+    extern seqlock_t clock_seq;
+    seqlock_write_begin(&clock_seq);
     clock += 1000000 / HZ;
+    seqlock_write_end(&clock_seq);
+#endif
     return 1;
   }
   return 0;
@@ -22,3 +22,12 @@ curcpu(void)
   asm volatile ("csrr %0, mscratch\n\t" : "=r" (c));
   return c;
 }
+
+// PC interrupted by the current trap
+static inline uintptr_t
+cpu_interrupted_pc(void)
+{
+  uintptr_t pc;
+  asm volatile ("csrr %0, mepc" : "=r" (pc));
+  return pc;
+}
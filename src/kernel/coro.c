@@ -0,0 +1,159 @@
+#include <mios/coro.h>
+#include <mios/mios.h>
+
+#include <unistd.h>
+
+#include "irq.h"
+
+#ifndef CORO_STACK_SIZE
+#define CORO_STACK_SIZE 2048
+#endif
+
+#ifndef CORO_PRIO
+#define CORO_PRIO 4
+#endif
+
+static STAILQ_HEAD(, coro) coro_runq = STAILQ_HEAD_INITIALIZER(coro_runq);
+static task_waitable_t coro_wait = WAITABLE_INITIALIZER("coro");
+static thread_t *coro_thread;
+
+
+// Called with IRQ_LEVEL_SCHED blocked
+static void
+coro_enqueue(coro_t *co)
+{
+  co->co_task.t_state = TASK_STATE_READY;
+  STAILQ_INSERT_TAIL(&coro_runq, co, co_link);
+  task_wakeup_sched_locked(&coro_wait, 0);
+}
+
+
+// Called from task_wakeup_sched_locked() with coroutine already
+// removed from the waitable's list
+void
+coro_wakeup_sched_locked(task_t *t)
+{
+  coro_t *co = (coro_t *)t;
+  co->co_waitable = NULL;
+  coro_enqueue(co);
+}
+
+
+static void
+coro_timeout(void *opaque, uint64_t expire)
+{
+  coro_t *co = opaque;
+
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  // If already woken the coroutine sees this when it checks again
+  co->co_timedout = 1;
+  if(co->co_task.t_state == TASK_STATE_SLEEPING) {
+    if(co->co_waitable != NULL) {
+      LIST_REMOVE(&co->co_task, t_wait_link);
+      co->co_waitable = NULL;
+    }
+    coro_enqueue(co);
+  }
+  irq_permit(q);
+}
+
+
+int
+coro_lock(void)
+{
+  return irq_forbid(IRQ_LEVEL_SCHED);
+}
+
+
+void
+coro_unlock(int q)
+{
+  irq_permit(q);
+}
+
+
+static int
+coro_prio_cmp(const task_t *a, const task_t *b)
+{
+  return a->t_prio <= b->t_prio;
+}
+
+
+void
+coro_sleep_locked(coro_t *co, task_waitable_t *waitable, int64_t deadline)
+{
+  co->co_task.t_state = TASK_STATE_SLEEPING;
+  co->co_waitable = waitable;
+  if(waitable != NULL)
+    LIST_INSERT_SORTED(&waitable->list, &co->co_task, t_wait_link,
+                       coro_prio_cmp);
+
+  if(deadline && !co->co_timer.t_expire)
+    timer_arm_abs(&co->co_timer, deadline);
+}
+
+
+void
+coro_wait_done(coro_t *co, int q)
+{
+  timer_disarm(&co->co_timer);
+  irq_permit(q);
+}
+
+
+void
+coro_yield(coro_t *co)
+{
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  coro_enqueue(co);
+  irq_permit(q);
+}
+
+
+static void *
+coro_executor(void *arg)
+{
+  int q = irq_forbid(IRQ_LEVEL_SCHED);
+  while(1) {
+    coro_t *co = STAILQ_FIRST(&coro_runq);
+    if(co == NULL) {
+      task_sleep_sched_locked(&coro_wait);
+      continue;
+    }
+    STAILQ_REMOVE_HEAD(&coro_runq, co_link);
+    co->co_task.t_state = TASK_STATE_RUNNING;
+    irq_permit(q);
+
+    co->co_fn(co);
+
+    q = irq_forbid(IRQ_LEVEL_SCHED);
+  }
+  return NULL;
+}
+
+
+void
+coro_start(coro_t *co, int (*fn)(coro_t *co))
+{
+  co->co_task.t_flags = TASK_CORO;
+  co->co_task.t_prio = CORO_PRIO;
+  co->co_fn = fn;
+  co->co_waitable = NULL;
+  co->co_line = 0;
+  co->co_timedout = 0;
+  co->co_timer.t_cb = coro_timeout;
+  co->co_timer.t_opaque = co;
+  co->co_timer.t_name = "coro";
+  co->co_timer.t_expire = 0;
+
+  static mutex_t start_mutex = MUTEX_INITIALIZER("coro");
+  mutex_lock(&start_mutex);
+  if(coro_thread == NULL)
+    coro_thread = thread_create(coro_executor, NULL, CORO_STACK_SIZE,
+                                "coro", 0, CORO_PRIO);
+  mutex_unlock(&start_mutex);
+
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  coro_enqueue(co);
+  irq_permit(q);
+}
@@ -6,7 +6,7 @@
 #include "irq.h"
 
 static STAILQ_HEAD(, device) devices = STAILQ_HEAD_INITIALIZER(devices);
-static mutex_t devs_mutex = MUTEX_INITIALIZER("devss");
+static rwlock_t devs_lock = RWLOCK_INITIALIZER("devs");
 
 
 void
@@ -14,17 +14,17 @@ device_register(device_t *d)
 {
   d->d_refcount = 1;
 
-  mutex_lock(&devs_mutex);
+  rwlock_wrlock(&devs_lock);
   STAILQ_INSERT_TAIL(&devices, d, d_link);
-  mutex_unlock(&devs_mutex);
+  rwlock_wrunlock(&devs_lock);
 }
 
 void
 device_unregister(device_t *d)
 {
-  mutex_lock(&devs_mutex);
+  rwlock_wrlock(&devs_lock);
   STAILQ_REMOVE(&devices, d, device, d_link);
-  mutex_unlock(&devs_mutex);
+  rwlock_wrunlock(&devs_lock);
   device_release(d);
 }
 
@@ -50,7 +50,7 @@ device_t *
 device_get_next(device_t *cur)
 {
   device_t *d;
-  mutex_lock(&devs_mutex);
+  rwlock_rdlock(&devs_lock);
 
   if(cur == NULL) {
     d = STAILQ_FIRST(&devices);
@@ -66,7 +66,7 @@ device_get_next(device_t *cur)
 
   if(d)
     device_retain(d);
-  mutex_unlock(&devs_mutex);
+  rwlock_rdunlock(&devs_lock);
   if(cur)
     device_release(cur);
   return d;
@@ -0,0 +1,256 @@
+#include <mios/irqstat.h>
+#include <mios/cli.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "irq.h"
+
+#ifdef HAVE_IRQSTAT
+
+/*
+ * Histograms have log2 buckets: <16, <32, <64, ... and the last one
+ * holds everything from 2^18 and up.
+ *
+ * Entry latency can only be measured for the clock IRQ as it is the
+ * only source where we know when it triggered.
+ *
+ * A masked section starts when irq_forbid() (or irq_permit()) moves
+ * away from the unmasked state and ends when it is moved back. Nested
+ * sections are part of the outermost one, whose call site is recorded.
+ * On SMP masked sections hold the giant lock so a single slot is
+ * enough.
+ */
+
+#define IRQSTAT_BUCKETS 16
+#define IRQSTAT_TOP     8
+
+typedef struct {
+  uint32_t count;
+  uint32_t max;
+  uint32_t bucket[IRQSTAT_BUCKETS];
+} irqstat_hist_t;
+
+typedef struct {
+  uintptr_t site;
+  uint32_t duration;
+} irqstat_site_t;
+
+uint8_t irqstat_enabled;
+
+static irqstat_hist_t *irqstat_vectors; // [IRQSTAT_VECTORS]
+static irqstat_hist_t irqstat_latency;
+static irqstat_hist_t irqstat_masked;
+
+static irqstat_site_t irqstat_top[IRQSTAT_TOP];
+static uint32_t irqstat_top_min;
+
+static uintptr_t mask_site; // 0 if no section is open
+static uint32_t mask_start;
+
+
+// Can be called from nested IRQs so update atomically
+static void
+irqstat_hist_add(irqstat_hist_t *h, uint32_t v)
+{
+  int b = v < 16 ? 0 : 28 - __builtin_clz(v);
+  if(b > IRQSTAT_BUCKETS - 1)
+    b = IRQSTAT_BUCKETS - 1;
+
+  __atomic_fetch_add(&h->bucket[b], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+  uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while(v > max &&
+        !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+
+void
+irqstat_irq(int vector, uint32_t duration)
+{
+  if(irqstat_vectors != NULL && vector < IRQSTAT_VECTORS)
+    irqstat_hist_add(&irqstat_vectors[vector], duration);
+}
+
+
+void
+irqstat_irq_latency(uint32_t latency)
+{
+  irqstat_hist_add(&irqstat_latency, latency);
+}
+
+
+// Keep the longest section per call site, replacing the shortest one
+static void
+irqstat_top_add(uintptr_t site, uint32_t duration)
+{
+  irqstat_site_t *min = &irqstat_top[0];
+
+  for(size_t i = 0; i < IRQSTAT_TOP; i++) {
+    irqstat_site_t *s = &irqstat_top[i];
+    if(s->site == site) {
+      if(duration > s->duration)
+        s->duration = duration;
+      return;
+    }
+    if(s->duration < min->duration)
+      min = s;
+  }
+  min->site = site;
+  min->duration = duration;
+
+  irqstat_top_min = UINT32_MAX;
+  for(size_t i = 0; i < IRQSTAT_TOP; i++) {
+    if(irqstat_top[i].duration < irqstat_top_min)
+      irqstat_top_min = irqstat_top[i].duration;
+  }
+}
+
+
+void
+irqstat_mask_begin(void)
+{
+  if(mask_site)
+    return;
+  mask_site = (uintptr_t)__builtin_return_address(0);
+  mask_start = irqstat_now();
+}
+
+
+void
+irqstat_mask_end(void)
+{
+  const uintptr_t site = mask_site;
+  if(!site)
+    return;
+  const uint32_t duration = irqstat_now() - mask_start;
+  mask_site = 0;
+
+  irqstat_hist_add(&irqstat_masked, duration);
+  if(duration > irqstat_top_min)
+    irqstat_top_add(site, duration);
+}
+
+
+static void
+irqstat_stop(void)
+{
+  irqstat_enabled = 0;
+  irq_stat_enable(0);
+}
+
+
+static error_t
+cmd_irqstat_start(cli_t *cli, int argc, char **argv)
+{
+  irqstat_stop();
+
+  const size_t size = IRQSTAT_VECTORS * sizeof(irqstat_hist_t);
+  if(irqstat_vectors == NULL) {
+    irqstat_vectors = xalloc(size, 0, MEM_MAY_FAIL);
+    if(irqstat_vectors == NULL)
+      return ERR_NO_MEMORY;
+  }
+  memset(irqstat_vectors, 0, size);
+  memset(&irqstat_latency, 0, sizeof(irqstat_latency));
+  memset(&irqstat_masked, 0, sizeof(irqstat_masked));
+  memset(irqstat_top, 0, sizeof(irqstat_top));
+  irqstat_top_min = 0;
+
+  irq_stat_enable(1);
+
+  const int q = irq_forbid(IRQ_LEVEL_ALL);
+  mask_site = 0;
+  irqstat_enabled = 1;
+  irq_permit(q);
+  return 0;
+}
+
+CLI_CMD_DEF("irqstat-start", cmd_irqstat_start);
+
+
+static error_t
+cmd_irqstat_stop(cli_t *cli, int argc, char **argv)
+{
+  irqstat_stop();
+  return 0;
+}
+
+CLI_CMD_DEF("irqstat-stop", cmd_irqstat_stop);
+
+
+static void
+irqstat_print_hist(cli_t *cli, const char *name, const irqstat_hist_t *h)
+{
+  if(h->count == 0)
+    return;
+
+  cli_printf(cli, "  %-10s %9u %9u ", name,
+             (unsigned int)h->count, (unsigned int)h->max);
+
+  for(int i = 0; i < IRQSTAT_BUCKETS; i++) {
+    if(h->bucket[i] == 0)
+      continue;
+    cli_printf(cli, " %s%u:%u", i == IRQSTAT_BUCKETS - 1 ? ">=" : "<",
+               i == IRQSTAT_BUCKETS - 1 ? 16 << (i - 1) : 16 << i,
+               (unsigned int)h->bucket[i]);
+  }
+  cli_printf(cli, "\n");
+}
+
+
+static error_t
+cmd_irqstat(cli_t *cli, int argc, char **argv)
+{
+  if(irqstat_vectors == NULL)
+    return ERR_NOT_FOUND;
+
+  cli_printf(cli, "Unit: %s%s\n", IRQSTAT_UNIT,
+             irqstat_enabled ? "" : " (stopped)");
+  cli_printf(cli, "               Count       Max  Distribution\n");
+
+  cli_printf(cli, "Entry latency\n");
+  irqstat_print_hist(cli, "clock", &irqstat_latency);
+
+  cli_printf(cli, "Handler duration\n");
+  char name[16];
+  for(int v = 0; v < IRQSTAT_VECTORS; v++) {
+    const int irq = IRQSTAT_VECTOR_IRQ(v);
+    if(irq < 0)
+      strlcpy(name, "systick", sizeof(name));
+    else
+      snprintf(name, sizeof(name), "irq %d", irq);
+    irqstat_print_hist(cli, name, &irqstat_vectors[v]);
+  }
+
+  cli_printf(cli, "IRQs masked\n");
+  irqstat_print_hist(cli, "all", &irqstat_masked);
+
+  irqstat_site_t top[IRQSTAT_TOP];
+  const int q = irq_forbid(IRQ_LEVEL_ALL);
+  memcpy(top, irqstat_top, sizeof(top));
+  irq_permit(q);
+
+  // Longest first
+  for(size_t i = 1; i < IRQSTAT_TOP; i++) {
+    const irqstat_site_t x = top[i];
+    size_t j = i;
+    for(; j > 0 && x.duration > top[j - 1].duration; j--)
+      top[j] = top[j - 1];
+    top[j] = x;
+  }
+
+  cli_printf(cli, "Longest masked sections\n");
+  for(size_t i = 0; i < IRQSTAT_TOP && top[i].site; i++) {
+    cli_printf(cli, "  0x%08x %9u\n",
+               (unsigned int)top[i].site, (unsigned int)top[i].duration);
+  }
+  return 0;
+}
+
+CLI_CMD_DEF("irqstat", cmd_irqstat);
+
+#endif
@@ -6,5 +6,16 @@ SRCS += ${SRC}/kernel/mios.c \
 	${SRC}/kernel/device.c \
 	${SRC}/kernel/timer.c \
 	${SRC}/kernel/eventlog.c \
+	${SRC}/kernel/ring.c \
+	${SRC}/kernel/coro.c \
+	${SRC}/kernel/workqueue.c \
+	${SRC}/kernel/slab.c \
+
+SRCS-${ENABLE_TRACE} += ${SRC}/kernel/trace.c
+SRCS-${ENABLE_PERF} += ${SRC}/kernel/perf.c
+SRCS-${ENABLE_IRQSTAT} += ${SRC}/kernel/irqstat.c
+SRCS-${ENABLE_BENCH} += ${SRC}/kernel/timer_bench.c \
+	${SRC}/kernel/ring_bench.c
+SRCS-${ENABLE_LOAD_HISTORY}-${ENABLE_TASK_ACCOUNTING} += ${SRC}/kernel/loadhist.c
 
 ${MOS}/kernel/%.o : CFLAGS += ${NOFPU}
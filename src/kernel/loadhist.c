@@ -0,0 +1,237 @@
+#include <mios/task.h>
+#include <mios/cli.h>
+#include <mios/stream.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#ifdef ENABLE_NET_HTTP
+#include "net/http/http.h"
+#include "net/http/http_parser.h"
+#endif
+
+/*
+ * Presentation of the load history recorded by accounting_run()
+ *
+ * "cpu" is everything but the idle thread. Time spent in IRQ handlers
+ * is accounted to the thread that was interrupted.
+ *
+ * load_history_t is too large for thread stacks, copies are made on
+ * the heap.
+ */
+
+static const char load_spark[] = " .:-=+*#%@";
+
+
+static int
+load_ring_size(int minutes)
+{
+  return minutes ? LOAD_HISTORY_MINUTES : LOAD_HISTORY_SECONDS;
+}
+
+
+// Number of samples available
+static int
+load_ring_count(uint32_t seconds, int minutes)
+{
+  const uint32_t n = minutes ? seconds / 60 : seconds;
+  const int size = load_ring_size(minutes);
+  return n < (uint32_t)size ? (int)n : size;
+}
+
+
+// Sample i (0 is the newest), count must be checked by caller
+static int
+load_ring_get(const load_history_t *lh, uint32_t seconds, int minutes,
+              int i, int invert)
+{
+  int v;
+  if(minutes) {
+    v = lh->lh_min[(seconds / 60 - 1 - i) % LOAD_HISTORY_MINUTES];
+  } else {
+    v = lh->lh_sec[(seconds - 1 - i) % LOAD_HISTORY_SECONDS];
+  }
+  if(invert)
+    v = v < 10000 ? 10000 - v : 0;
+  return v;
+}
+
+
+static void
+load_print_spark(stream_t *st, const char *name, const load_history_t *lh,
+                 uint32_t seconds, int minutes, int invert)
+{
+  const int count = load_ring_count(seconds, minutes);
+  const int size = load_ring_size(minutes);
+  const int now = count ? load_ring_get(lh, seconds, minutes, 0, invert) : 0;
+  int peak = 0;
+  char line[LOAD_HISTORY_SECONDS > LOAD_HISTORY_MINUTES ?
+            LOAD_HISTORY_SECONDS + 1 : LOAD_HISTORY_MINUTES + 1];
+
+  // Oldest to the left, unrecorded samples are blank
+  for(int i = 0; i < size; i++) {
+    const int age = size - 1 - i;
+    if(age >= count) {
+      line[i] = ' ';
+      continue;
+    }
+    int v = load_ring_get(lh, seconds, minutes, age, invert);
+    if(v > peak)
+      peak = v;
+    if(v > 10000)
+      v = 10000;
+    line[i] = load_spark[v ? 1 + (v - 1) * 9 / 10000 : 0];
+  }
+  line[size] = 0;
+
+  stprintf(st, " %-11s %3d.%02d%% %3d.%02d%% |%s|\n", name,
+           now / 100, now % 100, peak / 100, peak % 100, line);
+}
+
+
+static error_t
+cmd_load(cli_t *cli, int argc, char **argv)
+{
+  const int minutes = argc > 1 && argv[1][0] == 'm';
+  load_history_t *lh = xalloc(sizeof(load_history_t), 0, MEM_MAY_FAIL);
+  if(lh == NULL)
+    return ERR_NO_MEMORY;
+
+  cli_printf(cli, "Last %d %s, oldest first\n", load_ring_size(minutes),
+             minutes ? "minutes" : "seconds");
+  cli_printf(cli, " Name           Now     Peak   History\n");
+
+  uint32_t seconds = load_history_get(NULL, lh);
+  load_print_spark(cli->cl_stream, "cpu", lh, seconds, minutes, 1);
+  load_print_spark(cli->cl_stream, "idle", lh, seconds, minutes, 0);
+
+  thread_t *t = NULL;
+  while((t = thread_get_next(t)) != NULL) {
+    seconds = load_history_get(t, lh);
+    load_print_spark(cli->cl_stream, t->t_name, lh, seconds, minutes, 0);
+  }
+  free(lh);
+  return 0;
+}
+
+CLI_CMD_DEF("load", cmd_load);
+
+
+#ifdef ENABLE_RPC
+
+#include <mios/rpc.h>
+
+/*
+ * load_history(name, which) returns load in 0.01% units for "cpu",
+ * "idle" or a thread. which 0-59 is seconds ago, 60-119 is minutes ago
+ */
+static error_t
+rpc_load_history(rpc_result_t *rr, const char *name, int which)
+{
+  const int minutes = which >= LOAD_HISTORY_SECONDS;
+  const int i = minutes ? which - LOAD_HISTORY_SECONDS : which;
+  if(i < 0 || i >= load_ring_size(minutes))
+    return ERR_INVALID_RPC_ARGS;
+
+  load_history_t *lh = xalloc(sizeof(load_history_t), 0, MEM_MAY_FAIL);
+  if(lh == NULL)
+    return ERR_NO_MEMORY;
+
+  uint32_t seconds = 0;
+  int invert = 0;
+  int found = 0;
+
+  if(!strcmp(name, "cpu") || !strcmp(name, "idle")) {
+    seconds = load_history_get(NULL, lh);
+    invert = name[0] == 'c';
+    found = 1;
+  } else {
+    thread_t *t = NULL;
+    while((t = thread_get_next(t)) != NULL) {
+      if(found || strcmp(t->t_name, name))
+        continue;
+      seconds = load_history_get(t, lh);
+      found = 1;
+    }
+  }
+
+  error_t err = ERR_NOT_FOUND;
+  if(found && i < load_ring_count(seconds, minutes)) {
+    rr->type = RPC_TYPE_INT;
+    rr->i32 = load_ring_get(lh, seconds, minutes, i, invert);
+    err = 0;
+  }
+  free(lh);
+  return err;
+}
+
+RPC_DEF("load_history(si)", rpc_load_history);
+
+#endif
+
+
+#ifdef ENABLE_NET_HTTP
+
+static void
+load_json_ring(stream_t *st, const load_history_t *lh, uint32_t seconds,
+               int minutes, int invert)
+{
+  const int count = load_ring_count(seconds, minutes);
+  stprintf(st, "\"%s\":[", minutes ? "min" : "sec");
+  for(int i = count - 1; i >= 0; i--) {
+    stprintf(st, "%d%s", load_ring_get(lh, seconds, minutes, i, invert),
+             i ? "," : "");
+  }
+  stprintf(st, "]");
+}
+
+
+static void
+load_json_entry(stream_t *st, const char *name, const load_history_t *lh,
+                uint32_t seconds, int invert)
+{
+  stprintf(st, "{\"name\":\"%s\",", name);
+  load_json_ring(st, lh, seconds, 0, invert);
+  stprintf(st, ",");
+  load_json_ring(st, lh, seconds, 1, invert);
+  stprintf(st, "}");
+}
+
+
+// Load in 0.01% units, oldest sample first
+static int
+load_http(http_request_t *hr, int argc, const char **argv)
+{
+  load_history_t *lh = xalloc(sizeof(load_history_t), 0, MEM_MAY_FAIL);
+  if(lh == NULL)
+    return HTTP_STATUS_SERVICE_UNAVAILABLE;
+
+  stream_t *st = http_response_begin(hr, 200, "application/json");
+
+  uint32_t seconds = load_history_get(NULL, lh);
+  stprintf(st, "{\"seconds\":%u,\"cpu\":", (unsigned int)seconds);
+  load_json_entry(st, "cpu", lh, seconds, 1);
+  stprintf(st, ",\"idle\":");
+  load_json_entry(st, "idle", lh, seconds, 0);
+  stprintf(st, ",\"threads\":[");
+
+  int first = 1;
+  thread_t *t = NULL;
+  while((t = thread_get_next(t)) != NULL) {
+    seconds = load_history_get(t, lh);
+    if(!first)
+      stprintf(st, ",");
+    load_json_entry(st, t->t_name, lh, seconds, 0);
+    first = 0;
+  }
+  stprintf(st, "]}\n");
+  st->close(st);
+  free(lh);
+  return 0;
+}
+
+HTTP_ROUTE_DEF("load.json", load_http);
+
+#endif
@@ -0,0 +1,369 @@
+#include <mios/task.h>
+#include <mios/perf.h>
+#include <mios/timer.h>
+#include <mios/cli.h>
+#include <mios/stream.h>
+#include <mios/version.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "irq.h"
+#include "cpu.h"
+
+#ifdef ENABLE_NET_HTTP
+#include "net/http/http.h"
+#endif
+
+/*
+ * Statistical profiler
+ *
+ * A timer IRQ samples the PC and thread it interrupted into a hash
+ * table. Samples where the IRQ preempted another IRQ (or where the CPU
+ * can't tell) are recorded with PC 0. The period is randomized by
+ * +-50% so sampling doesn't alias with periodic work.
+ *
+ * The platform's dedicated sampling timer is used if it has one (see
+ * mios/perf.h), otherwise a kernel timer. Without ENABLE_TICKLESS
+ * kernel timers may only fire on the tick (HZ, 100 on all platforms),
+ * so then the rate is limited to HZ and samples are tick aligned.
+ */
+
+#define PERF_MAX_HZ          10000 // Above this sampling overhead dominates
+#define PERF_DEFAULT_HZ      1000
+#ifdef ENABLE_TICKLESS
+#define PERF_TIMER_MAX_HZ    PERF_MAX_HZ
+#else
+#define PERF_TIMER_MAX_HZ    100
+#endif
+#define PERF_DEFAULT_BUCKETS 1024
+#define PERF_DEFAULT_TOP     5
+
+typedef struct {
+  uintptr_t pc;
+  thread_t *thread;
+  uint32_t count;
+} perf_bucket_t;
+
+static perf_bucket_t *perf_buckets;
+static uint32_t perf_mask;
+static uint32_t perf_period;
+static uint32_t perf_samples;
+static uint32_t perf_dropped;
+static uint32_t perf_rnd = 1;
+static uint64_t perf_started;
+static uint64_t perf_active; // Time sampled, excluding pauses
+static const char *perf_hw;  // Hardware timer in use, NULL if kernel timer
+static uint8_t perf_running;
+static timer_t perf_timer;
+
+
+const char * __attribute__((weak))
+perf_hwtimer_start(uint32_t period)
+{
+  return NULL;
+}
+
+
+void __attribute__((weak))
+perf_hwtimer_stop(void)
+{
+}
+
+
+static void
+perf_sample(uintptr_t pc, thread_t *t)
+{
+  uint32_t h = ((uint32_t)pc >> 1) * 0x9e3779b1 ^ (uint32_t)(uintptr_t)t;
+  perf_samples++;
+
+  for(uint32_t i = 0; i <= perf_mask; i++) {
+    perf_bucket_t *b = &perf_buckets[(h + i) & perf_mask];
+    if(b->count == 0) {
+      b->pc = pc;
+      b->thread = t;
+      b->count = 1;
+      return;
+    }
+    if(b->pc == pc && b->thread == t) {
+      b->count++;
+      return;
+    }
+  }
+  perf_dropped++;
+}
+
+
+static uint32_t
+perf_next_period(void)
+{
+  perf_rnd ^= perf_rnd << 13;
+  perf_rnd ^= perf_rnd >> 17;
+  perf_rnd ^= perf_rnd << 5;
+  return perf_period / 2 + perf_rnd % (perf_period + 1);
+}
+
+
+uint32_t
+perf_sample_irq(void)
+{
+  perf_sample(cpu_interrupted_pc(), thread_current());
+  return perf_next_period();
+}
+
+
+static void
+perf_timer_cb(void *opaque, uint64_t expire)
+{
+#ifdef ENABLE_TICKLESS
+  uint64_t next = expire + perf_sample_irq();
+#else
+  // Randomizing is pointless, we can only hit ticks anyway
+  perf_sample_irq();
+  uint64_t next = expire + perf_period;
+#endif
+  const uint64_t now = clock_get_irq_blocked();
+  if(next <= now)
+    next = now + perf_period;
+  timer_arm_abs(&perf_timer, next);
+}
+
+
+// Returns 1 if sampling was running
+static int
+perf_stop(void)
+{
+  int q = irq_forbid(IRQ_LEVEL_CLOCK);
+  const int was_running = perf_running;
+  if(was_running) {
+    if(perf_hw != NULL)
+      perf_hwtimer_stop();
+    else
+      timer_disarm(&perf_timer);
+    perf_active += clock_get_irq_blocked() - perf_started;
+    perf_running = 0;
+  }
+  irq_permit(q);
+  return was_running;
+}
+
+
+// Lengthens perf_period if only kernel timers are available and they
+// can't go that fast
+static void
+perf_start(void)
+{
+  int q = irq_forbid(IRQ_LEVEL_CLOCK);
+  perf_started = clock_get_irq_blocked();
+  perf_hw = perf_hwtimer_start(perf_period);
+  if(perf_hw == NULL) {
+    if(perf_period < 1000000 / PERF_TIMER_MAX_HZ)
+      perf_period = 1000000 / PERF_TIMER_MAX_HZ;
+    perf_timer.t_cb = perf_timer_cb;
+    perf_timer.t_name = "perf";
+    timer_arm_abs(&perf_timer, perf_started + perf_period);
+  }
+  perf_running = 1;
+  irq_permit(q);
+}
+
+
+// Order by thread, then by descending count
+static int
+perf_bucket_before(const perf_bucket_t *a, const perf_bucket_t *b)
+{
+  if(a->thread != b->thread)
+    return (uintptr_t)a->thread < (uintptr_t)b->thread;
+  return a->count > b->count;
+}
+
+
+static void
+perf_sort(const perf_bucket_t **v, size_t n)
+{
+  for(size_t i = 1; i < n; i++) {
+    const perf_bucket_t *x = v[i];
+    size_t j = i;
+    for(; j > 0 && perf_bucket_before(x, v[j - 1]); j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+}
+
+
+static void
+perf_thread_name(const void *t, char *buf, size_t len)
+{
+  if(thread_get_name(t, buf, len))
+    snprintf(buf, len, "%p", t);
+}
+
+
+static error_t
+cmd_perf_start(cli_t *cli, int argc, char **argv)
+{
+  int hz = argc > 1 ? atoi(argv[1]) : PERF_DEFAULT_HZ;
+  uint32_t buckets = argc > 2 ? atoi(argv[2]) : PERF_DEFAULT_BUCKETS;
+  if(hz < 1 || buckets < 2)
+    return ERR_INVALID_ARGS;
+  if(hz > PERF_MAX_HZ) {
+    cli_printf(cli, "Limiting to %d Hz\n", PERF_MAX_HZ);
+    hz = PERF_MAX_HZ;
+  }
+  buckets = 1 << (32 - __builtin_clz(buckets - 1));
+
+  perf_stop();
+
+  free(perf_buckets);
+  perf_buckets = xalloc(buckets * sizeof(perf_bucket_t), 0, MEM_MAY_FAIL);
+  if(perf_buckets == NULL)
+    return ERR_NO_MEMORY;
+  memset(perf_buckets, 0, buckets * sizeof(perf_bucket_t));
+  perf_mask = buckets - 1;
+  perf_samples = 0;
+  perf_dropped = 0;
+  perf_active = 0;
+  perf_period = 1000000 / hz;
+
+  perf_start();
+  if(perf_period > 1000000 / hz)
+    cli_printf(cli, "Kernel timers can't go faster than %d Hz\n",
+               PERF_TIMER_MAX_HZ);
+  cli_printf(cli, "Sampling at %d Hz from %s into %d buckets\n",
+             (int)(1000000 / perf_period), perf_hw ?: "kernel timer",
+             buckets);
+  return 0;
+}
+
+CLI_CMD_DEF("perf-start", cmd_perf_start);
+
+
+static error_t
+cmd_perf_stop(cli_t *cli, int argc, char **argv)
+{
+  perf_stop();
+  cli_printf(cli, "%d samples recorded, %d dropped, effective rate %d Hz\n",
+             perf_samples, perf_dropped, perf_active ?
+             (int)(perf_samples * 1000000ull / perf_active) : 0);
+  return 0;
+}
+
+CLI_CMD_DEF("perf-stop", cmd_perf_stop);
+
+
+static error_t
+cmd_perf(cli_t *cli, int argc, char **argv)
+{
+  const int top = argc > 1 ? atoi(argv[1]) : PERF_DEFAULT_TOP;
+  if(perf_buckets == NULL)
+    return ERR_NOT_FOUND;
+
+  // Pause so the table is stable while we sort and print
+  const int was_running = perf_stop();
+
+  size_t used = 0;
+  for(uint32_t i = 0; i <= perf_mask; i++)
+    used += perf_buckets[i].count != 0;
+
+  const perf_bucket_t **v = xalloc(used * sizeof(perf_bucket_t *) + 1, 0,
+                                   MEM_MAY_FAIL);
+  if(v == NULL) {
+    if(was_running)
+      perf_start();
+    return ERR_NO_MEMORY;
+  }
+
+  used = 0;
+  for(uint32_t i = 0; i <= perf_mask; i++) {
+    if(perf_buckets[i].count)
+      v[used++] = &perf_buckets[i];
+  }
+  perf_sort(v, used);
+
+  const uint32_t total = perf_samples ?: 1;
+  char name[16];
+
+  for(size_t i = 0; i < used; ) {
+    const thread_t *t = v[i]->thread;
+    uint32_t thread_samples = 0;
+    size_t end = i;
+    for(; end < used && v[end]->thread == t; end++)
+      thread_samples += v[end]->count;
+
+    perf_thread_name(t, name, sizeof(name));
+    cli_printf(cli, "%-16s %3d%%  %d samples\n", name,
+               (int)((uint64_t)thread_samples * 100 / total), thread_samples);
+
+    for(int j = 0; j < top && i + j < end; j++) {
+      const perf_bucket_t *b = v[i + j];
+      char pc[12];
+      if(b->pc)
+        snprintf(pc, sizeof(pc), "0x%08x", (unsigned int)b->pc);
+      else
+        strlcpy(pc, "<irq>", sizeof(pc));
+      cli_printf(cli, "  %-10s %3d%%  %d\n", pc,
+                 (int)((uint64_t)b->count * 100 / total), b->count);
+    }
+    i = end;
+  }
+  cli_printf(cli, "%d samples, %d dropped\n", perf_samples, perf_dropped);
+
+  free(v);
+  if(was_running)
+    perf_start();
+  return 0;
+}
+
+CLI_CMD_DEF("perf", cmd_perf);
+
+
+// One line per bucket with the build-id first so the addresses can be
+// symbolized offline against the right ELF (addr2line -f -e ...)
+static void
+perf_export(stream_t *st)
+{
+  const int was_running = perf_stop();
+
+  stprintf(st, "build-id ");
+  sthexstr(st, mios_build_id(), 20);
+  stprintf(st, "\nsamples %d dropped %d\n", perf_samples, perf_dropped);
+
+  char name[16];
+  for(uint32_t i = 0; perf_buckets != NULL && i <= perf_mask; i++) {
+    const perf_bucket_t *b = &perf_buckets[i];
+    if(!b->count)
+      continue;
+    perf_thread_name(b->thread, name, sizeof(name));
+    stprintf(st, "0x%08x %s %d\n", (unsigned int)b->pc, name, b->count);
+  }
+
+  if(was_running)
+    perf_start();
+}
+
+
+static error_t
+cmd_perf_dump(cli_t *cli, int argc, char **argv)
+{
+  perf_export(cli->cl_stream);
+  return 0;
+}
+
+CLI_CMD_DEF("perf-dump", cmd_perf_dump);
+
+
+#ifdef ENABLE_NET_HTTP
+static int
+perf_http(http_request_t *hr, int argc, const char **argv)
+{
+  stream_t *st = http_response_begin(hr, 200, "text/plain");
+  perf_export(st);
+  st->close(st);
+  return 0;
+}
+
+HTTP_ROUTE_DEF("perf.txt", perf_http);
+#endif
@@ -0,0 +1,194 @@
+#include <mios/ring.h>
+#include <mios/mios.h>
+
+#include <string.h>
+#include <unistd.h>
+
+#include "irq.h"
+
+static inline uint32_t
+ring_advance(const ring_t *r, uint32_t pos, uint32_t n)
+{
+  pos += n;
+  return pos >= 2 * r->r_size ? pos - 2 * r->r_size : pos;
+}
+
+
+static inline uint32_t
+ring_distance(const ring_t *r, uint32_t head, uint32_t tail)
+{
+  return head >= tail ? head - tail : head + 2 * r->r_size - tail;
+}
+
+
+static inline uint32_t
+ring_slot(const ring_t *r, uint32_t pos)
+{
+  return pos >= r->r_size ? pos - r->r_size : pos;
+}
+
+
+void
+ring_init(ring_t *r, void *buf, size_t esize, size_t size,
+          uint8_t *ready, const char *name)
+{
+  r->r_head = 0;
+  r->r_tail = 0;
+  r->r_size = size;
+  r->r_esize = esize;
+  r->r_buf = buf;
+  r->r_ready = ready;
+  if(ready != NULL)
+    memset(ready, 0, size);
+  task_waitable_init(&r->r_wait, name);
+}
+
+
+size_t
+ring_used(const ring_t *r)
+{
+  return ring_distance(r,
+                       __atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE),
+                       __atomic_load_n(&r->r_tail, __ATOMIC_ACQUIRE));
+}
+
+
+// Copy n elements between the ring at pos and a linear buffer
+static void
+ring_copy(ring_t *r, uint32_t pos, void *p, size_t n, int to_ring)
+{
+  const uint32_t slot = ring_slot(r, pos);
+  size_t first = r->r_size - slot;
+  if(first > n)
+    first = n;
+
+  uint8_t *a = r->r_buf + slot * r->r_esize;
+  const size_t first_bytes = first * r->r_esize;
+  const size_t rest_bytes = (n - first) * r->r_esize;
+
+  if(to_ring) {
+    memcpy(a, p, first_bytes);
+    memcpy(r->r_buf, p + first_bytes, rest_bytes);
+  } else {
+    memcpy(p, a, first_bytes);
+    memcpy(p + first_bytes, r->r_buf, rest_bytes);
+  }
+}
+
+
+size_t
+ring_put(ring_t *r, const void *src, size_t count, int flags)
+{
+  uint32_t head = __atomic_load_n(&r->r_head, __ATOMIC_RELAXED);
+  uint32_t tail, n;
+
+  if(r->r_ready == NULL) {
+    tail = __atomic_load_n(&r->r_tail, __ATOMIC_ACQUIRE);
+    n = r->r_size - ring_distance(r, head, tail);
+    if(n > count)
+      n = count;
+    if(n == 0)
+      return 0;
+    ring_copy(r, head, (void *)src, n, 1);
+    __atomic_store_n(&r->r_head, ring_advance(r, head, n), __ATOMIC_RELEASE);
+
+  } else {
+    do {
+      tail = __atomic_load_n(&r->r_tail, __ATOMIC_ACQUIRE);
+      n = r->r_size - ring_distance(r, head, tail);
+      if(n > count)
+        n = count;
+      if(n == 0)
+        return 0;
+    } while(!__atomic_compare_exchange_n(&r->r_head, &head,
+                                         ring_advance(r, head, n), 1,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_RELAXED));
+
+    ring_copy(r, head, (void *)src, n, 1);
+    uint32_t pos = head;
+    for(uint32_t i = 0; i < n; i++) {
+      __atomic_store_n(&r->r_ready[ring_slot(r, pos)], 1, __ATOMIC_RELEASE);
+      pos = ring_advance(r, pos, 1);
+    }
+  }
+
+  if(!(flags & RING_NOWAKE)) {
+    // If the consumer has caught up with us it might be sleeping.
+    // Pairs with the fence in ring_get_wait()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&r->r_tail, __ATOMIC_RELAXED) == head)
+      task_wakeup(&r->r_wait, 0);
+  }
+  return n;
+}
+
+
+size_t
+ring_get(ring_t *r, void *dst, size_t count)
+{
+  const uint32_t tail = r->r_tail;
+  const uint32_t head = __atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE);
+  uint32_t n = ring_distance(r, head, tail);
+  if(n > count)
+    n = count;
+
+  if(r->r_ready != NULL) {
+    // Stop at first slot where producer is not done yet
+    uint32_t pos = tail;
+    for(uint32_t i = 0; i < n; i++) {
+      uint8_t *ready = &r->r_ready[ring_slot(r, pos)];
+      if(!__atomic_load_n(ready, __ATOMIC_ACQUIRE)) {
+        n = i;
+        break;
+      }
+      *ready = 0;
+      pos = ring_advance(r, pos, 1);
+    }
+  }
+
+  if(n == 0)
+    return 0;
+
+  ring_copy(r, tail, dst, n, 0);
+  __atomic_store_n(&r->r_tail, ring_advance(r, tail, n), __ATOMIC_RELEASE);
+  return n;
+}
+
+
+static int
+ring_readable(const ring_t *r)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  const uint32_t tail = r->r_tail;
+  if(__atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE) == tail)
+    return 0;
+  return r->r_ready == NULL ||
+    __atomic_load_n(&r->r_ready[ring_slot(r, tail)], __ATOMIC_ACQUIRE);
+}
+
+
+size_t
+ring_get_wait(ring_t *r, void *dst, size_t count, int64_t deadline)
+{
+  while(1) {
+    const size_t n = ring_get(r, dst, count);
+    if(n)
+      return n;
+
+    // Producers at or below IRQ_LEVEL_SCHED can't slip in a wakeup
+    // between the check and the sleep
+    const int q = irq_forbid(IRQ_LEVEL_SCHED);
+    int timeout = 0;
+    if(!ring_readable(r)) {
+      if(deadline)
+        timeout = task_sleep_deadline(&r->r_wait, deadline);
+      else
+        task_sleep(&r->r_wait);
+    }
+    irq_permit(q);
+    if(timeout)
+      return 0;
+  }
+}
+
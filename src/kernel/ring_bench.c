@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <mios/ring.h>
+#include <mios/fifo.h>
+#include <mios/cli.h>
+
+#include "irq.h"
+
+/*
+ * Benchmark against the irq_forbid() protected fifo used by drivers
+ */
+
+#define RINGBENCH_ROUNDS 10000
+
+static error_t
+cmd_ringbench(cli_t *cli, int argc, char **argv)
+{
+  static FIFO_DECL(fifo, 64);
+  static RING_SPSC_DECL(spsc, uint8_t, 64);
+  static RING_MPSC_DECL(mpsc, uint8_t, 64);
+  uint8_t batch[16];
+
+  ring_spsc_init(&spsc, "ringbench");
+  ring_mpsc_init(&mpsc, "ringbench");
+  fifo.rdptr = fifo.wrptr = 0;
+
+  cli_printf(cli, "Put+get of one byte, %d rounds\n", RINGBENCH_ROUNDS);
+
+  uint64_t t0 = clock_get();
+  for(int i = 0; i < RINGBENCH_ROUNDS; i++) {
+    int q = irq_forbid(IRQ_LEVEL_IO);
+    fifo_wr(&fifo, i);
+    irq_permit(q);
+    q = irq_forbid(IRQ_LEVEL_IO);
+    batch[0] = fifo_rd(&fifo);
+    irq_permit(q);
+  }
+  uint64_t t1 = clock_get();
+  cli_printf(cli, "  fifo+irq_forbid %6d ns\n",
+             (int)((t1 - t0) * 1000 / RINGBENCH_ROUNDS));
+
+  ring_t *rings[2] = {&spsc.r, &mpsc.r};
+  const char *names[2] = {"spsc", "mpsc"};
+
+  for(int j = 0; j < 2; j++) {
+    ring_t *r = rings[j];
+    t0 = clock_get();
+    for(int i = 0; i < RINGBENCH_ROUNDS; i++) {
+      batch[0] = i;
+      ring_put(r, batch, 1, RING_NOWAKE);
+      ring_get(r, batch, 1);
+    }
+    t1 = clock_get();
+    cli_printf(cli, "  %-15s %6d ns\n", names[j],
+               (int)((t1 - t0) * 1000 / RINGBENCH_ROUNDS));
+  }
+
+  cli_printf(cli, "Put+get of %d bytes in one batch\n", (int)sizeof(batch));
+  for(int j = 0; j < 2; j++) {
+    ring_t *r = rings[j];
+    t0 = clock_get();
+    for(int i = 0; i < RINGBENCH_ROUNDS; i++) {
+      ring_put(r, batch, sizeof(batch), RING_NOWAKE);
+      ring_get(r, batch, sizeof(batch));
+    }
+    t1 = clock_get();
+    cli_printf(cli, "  %-15s %6d ns\n", names[j],
+               (int)((t1 - t0) * 1000 / RINGBENCH_ROUNDS));
+  }
+  return 0;
+}
+
+CLI_CMD_DEF("ringbench", cmd_ringbench);
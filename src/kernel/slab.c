@@ -0,0 +1,210 @@
+#include <mios/slab.h>
+#include <mios/stream.h>
+#include <mios/mios.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#define SLAB_ALIGN    8
+#define SLAB_MIN_SIZE 256
+#define SLAB_MAX_SIZE 2048 // Don't grow beyond this to fit more objects
+#define SLAB_MIN_OBJS 4
+
+typedef struct slab {
+  LIST_ENTRY(slab) s_link;
+  void *s_free;
+  uint16_t s_inuse;
+} slab_t;
+
+#define SLAB_HDR_SIZE ((sizeof(slab_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+static mutex_t slab_caches_mutex = MUTEX_INITIALIZER("slabs");
+
+static SLIST_HEAD(, slab_cache) slab_caches;
+
+
+static void
+slab_cache_setup(slab_cache_t *sc)
+{
+  mutex_lock(&slab_caches_mutex);
+  if(sc->sc_per_slab == 0) {
+    const size_t size = (sc->sc_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    size_t slab_size = SLAB_MIN_SIZE;
+    while(slab_size < SLAB_HDR_SIZE + size)
+      slab_size <<= 1;
+    while(slab_size < SLAB_MAX_SIZE &&
+          (slab_size - SLAB_HDR_SIZE) / size < SLAB_MIN_OBJS)
+      slab_size <<= 1;
+
+    const size_t per_slab = (slab_size - SLAB_HDR_SIZE) / size;
+    sc->sc_size = size;
+    // No need to allocate the tail that doesn't fit an object
+    sc->sc_slab_size = SLAB_HDR_SIZE + per_slab * size;
+    SLIST_INSERT_HEAD(&slab_caches, sc, sc_link);
+    sc->sc_per_slab = per_slab;
+  }
+  mutex_unlock(&slab_caches_mutex);
+}
+
+
+static slab_t *
+slab_create(slab_cache_t *sc)
+{
+  slab_t *s = xalloc(sc->sc_slab_size, SLAB_ALIGN, MEM_MAY_FAIL);
+  if(s == NULL)
+    return NULL;
+
+  void *obj = (void *)s + SLAB_HDR_SIZE;
+  s->s_free = NULL;
+  for(int i = 0; i < sc->sc_per_slab; i++) {
+    *(void **)obj = s->s_free;
+    s->s_free = obj;
+    obj += sc->sc_size;
+  }
+  s->s_inuse = 0;
+  return s;
+}
+
+
+void *
+slab_alloc(slab_cache_t *sc)
+{
+  if(sc->sc_per_slab == 0)
+    slab_cache_setup(sc);
+
+  mutex_lock(&sc->sc_mutex);
+
+  slab_t *s = LIST_FIRST(&sc->sc_partial);
+  if(s == NULL) {
+    s = LIST_FIRST(&sc->sc_empty);
+    if(s != NULL) {
+      LIST_REMOVE(s, s_link);
+      sc->sc_num_empty--;
+    } else {
+      // Don't hold the cache lock over the heap, it may call
+      // slab_reclaim()
+      mutex_unlock(&sc->sc_mutex);
+      slab_t *ns = slab_create(sc);
+      mutex_lock(&sc->sc_mutex);
+      if(ns == NULL) {
+        sc->sc_fails++;
+        mutex_unlock(&sc->sc_mutex);
+        return NULL;
+      }
+      sc->sc_slabs++;
+      s = ns;
+    }
+    LIST_INSERT_HEAD(&sc->sc_partial, s, s_link);
+  }
+
+  void *obj = s->s_free;
+  s->s_free = *(void **)obj;
+  s->s_inuse++;
+  if(s->s_free == NULL) {
+    LIST_REMOVE(s, s_link);
+    LIST_INSERT_HEAD(&sc->sc_full, s, s_link);
+  }
+
+  sc->sc_inuse++;
+  if(sc->sc_inuse > sc->sc_peak)
+    sc->sc_peak = sc->sc_inuse;
+  mutex_unlock(&sc->sc_mutex);
+
+  if(sc->sc_ctor != NULL)
+    sc->sc_ctor(obj);
+  return obj;
+}
+
+
+// Slabs are not aligned to their size (that leaves holes in the heap)
+// so look for the one whose range holds obj. Empty slabs can't own it
+static slab_t *
+slab_find(slab_cache_t *sc, const void *obj)
+{
+  slab_t *s;
+  LIST_FOREACH(s, &sc->sc_full, s_link) {
+    if(obj > (void *)s && obj < (void *)s + sc->sc_slab_size)
+      return s;
+  }
+  LIST_FOREACH(s, &sc->sc_partial, s_link) {
+    if(obj > (void *)s && obj < (void *)s + sc->sc_slab_size)
+      return s;
+  }
+  panic("slab: %p not in cache %s", obj, sc->sc_name);
+}
+
+
+void
+slab_free(slab_cache_t *sc, void *obj)
+{
+  if(obj == NULL)
+    return;
+
+  slab_t *release = NULL;
+
+  mutex_lock(&sc->sc_mutex);
+  slab_t *s = slab_find(sc, obj);
+  if(s->s_free == NULL) {
+    LIST_REMOVE(s, s_link);
+    LIST_INSERT_HEAD(&sc->sc_partial, s, s_link);
+  }
+
+  *(void **)obj = s->s_free;
+  s->s_free = obj;
+  s->s_inuse--;
+  sc->sc_inuse--;
+
+  if(s->s_inuse == 0) {
+    LIST_REMOVE(s, s_link);
+    if(sc->sc_num_empty) {
+      sc->sc_slabs--;
+      release = s;
+    } else {
+      LIST_INSERT_HEAD(&sc->sc_empty, s, s_link);
+      sc->sc_num_empty++;
+    }
+  }
+  mutex_unlock(&sc->sc_mutex);
+  free(release);
+}
+
+
+size_t
+slab_reclaim(void)
+{
+  size_t total = 0;
+  slab_cache_t *sc;
+
+  // Caches busy in another thread are skipped
+  SLIST_FOREACH(sc, &slab_caches, sc_link) {
+    if(mutex_trylock(&sc->sc_mutex))
+      continue;
+
+    slab_t *s;
+    while((s = LIST_FIRST(&sc->sc_empty)) != NULL) {
+      LIST_REMOVE(s, s_link);
+      sc->sc_num_empty--;
+      sc->sc_slabs--;
+      total += sc->sc_slab_size;
+      free(s);
+    }
+    mutex_unlock(&sc->sc_mutex);
+  }
+  return total;
+}
+
+
+void
+slab_print_stats(stream_t *st)
+{
+  slab_cache_t *sc;
+
+  stprintf(st, "Object caches\n");
+  stprintf(st, " Name             Size  Slab  Slabs  Inuse   Peak  Fails\n");
+  SLIST_FOREACH(sc, &slab_caches, sc_link) {
+    stprintf(st, " %-14s %6d %5d %6d %6d %6d %6d\n",
+             sc->sc_name, sc->sc_size, (int)sc->sc_slab_size, sc->sc_slabs,
+             sc->sc_inuse, sc->sc_peak, (int)sc->sc_fails);
+  }
+}
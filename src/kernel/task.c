@@ -14,6 +14,9 @@
 #include <mios/mios.h>
 #include <mios/cli.h>
 #include <mios/timer.h>
+#include <mios/trace.h>
+#include <mios/coro.h>
+#include <mios/eventlog.h>
 
 #include "irq.h"
 #include "cpu.h"
@@ -63,7 +66,11 @@ softirq_raise(uint32_t id)
 inline thread_t *
 thread_current(void)
 {
+#ifdef ENABLE_SMP
+  return cpu_thread_current();
+#else
   return curcpu()->sched.current;
+#endif
 }
 
 inline task_t *
@@ -72,7 +79,7 @@ task_current(void)
   return &thread_current()->t_task;
 }
 
-#ifdef ENABLE_TASK_DEBUG
+#if defined(ENABLE_TASK_DEBUG) || defined(ENABLE_SMP)
 
 static int
 task_is_on_queue(task_t *t, struct task_queue *q)
@@ -86,6 +93,10 @@ task_is_on_queue(task_t *t, struct task_queue *q)
   return 0;
 }
 
+#endif
+
+#ifdef ENABLE_TASK_DEBUG
+
 
 static int
 task_is_on_list(task_t *t, struct task_list *l)
@@ -111,6 +122,98 @@ task_is_on_readyqueue(cpu_t *cpu, task_t *t)
 }
 #endif
 
+/*
+ * Return non-zero if task is the current thread of any CPU. It may
+ * still be in the process of going to sleep, in which case the waker
+ * must flip it back to running instead of putting it on a readyqueue
+ */
+static int
+task_is_on_cpu(const task_t *t)
+{
+#ifdef ENABLE_SMP
+  for(int i = 0; i < CPU_MAX; i++) {
+    if(cpus[i].sched.current == (const thread_t *)t)
+      return 1;
+  }
+  return 0;
+#else
+  return t == &curcpu()->sched.current->t_task;
+#endif
+}
+
+
+#ifdef ENABLE_SMP
+
+/*
+ * A thread was made ready on cpu. If cpu is not going to preempt for
+ * it, poke the CPU running the lowest priority thread so it will steal
+ * it in task_switch()
+ */
+static void
+sched_kick(cpu_t *cpu, const task_t *t)
+{
+  if(!(t->t_flags & TASK_THREAD))
+    return; // Plain tasks always run on the CPU they were queued on
+
+  if(cpu->sched.current->t_task.t_prio < t->t_prio)
+    return;
+
+  cpu_t *target = NULL;
+  int prio = t->t_prio;
+  const uint32_t online = cpus_online;
+  for(int i = 0; i < CPU_MAX; i++) {
+    cpu_t *c = &cpus[i];
+    if(c == cpu || !(online & (1 << i)))
+      continue;
+    const int p = c->sched.current->t_task.t_prio;
+    if(p < prio) {
+      prio = p;
+      target = c;
+    }
+  }
+  if(target != NULL)
+    cpu_kick(target);
+}
+
+
+/*
+ * Take the highest priority thread from another CPU's readyqueue if it
+ * beats what we have locally. Plain tasks are never stolen
+ */
+static task_t *
+readyqueue_steal(cpu_t *cpu)
+{
+  cpu_t *victim = NULL;
+  int best = cpu->sched.active_queues ?
+    31 - __builtin_clz(cpu->sched.active_queues) : 0;
+  const uint32_t online = cpus_online;
+
+  for(int i = 0; i < CPU_MAX; i++) {
+    cpu_t *c = &cpus[i];
+    if(c == cpu || !(online & (1 << i)) || !c->sched.active_queues)
+      continue;
+    const int which = 31 - __builtin_clz(c->sched.active_queues);
+    if(which > best &&
+       STAILQ_FIRST(&c->sched.readyqueue[which])->t_flags & TASK_THREAD) {
+      best = which;
+      victim = c;
+    }
+  }
+
+  if(victim == NULL)
+    return NULL;
+
+  task_t *task = STAILQ_FIRST(&victim->sched.readyqueue[best]);
+  STAILQ_REMOVE_HEAD(&victim->sched.readyqueue[best], t_ready_link);
+  if(STAILQ_FIRST(&victim->sched.readyqueue[best]) == NULL) {
+    victim->sched.active_queues &= ~(1 << best);
+  }
+  return task;
+}
+
+#endif
+
+
 static void
 readyqueue_insert(cpu_t *cpu, task_t *t, const char *whom)
 {
@@ -129,6 +232,9 @@ readyqueue_insert(cpu_t *cpu, task_t *t, const char *whom)
   STAILQ_INSERT_TAIL(&cpu->sched.readyqueue[t->t_prio], t, t_ready_link);
   cpu->sched.active_queues |= 1 << t->t_prio;
   t->t_state = TASK_STATE_READY;
+#ifdef ENABLE_SMP
+  sched_kick(cpu, t);
+#endif
 }
 
 
@@ -160,6 +266,15 @@ task_switch(void *cur_sp)
 
   thread_t *t;
 
+#ifdef ENABLE_SMP
+  if(curthread->t_task.t_state == TASK_STATE_ZOMBIE &&
+     !(curthread->t_task.t_flags & TASK_THREAD)) {
+    // Released while still on this CPU, reap it now that we are
+    // off its stack
+    readyqueue_insert(cpu, &curthread->t_task, "zombie");
+  }
+#endif
+
   while(1) {
 
     if(curthread->t_task.t_state == TASK_STATE_RUNNING) {
@@ -169,6 +284,12 @@ task_switch(void *cur_sp)
 
     task_t *task;
 
+#ifdef ENABLE_SMP
+    task = readyqueue_steal(cpu);
+    if(task != NULL) {
+      // Higher priority thread taken from another CPU
+    } else
+#endif
     if(!cpu->sched.active_queues) {
 
       task = cpu->sched.idle;
@@ -202,8 +323,14 @@ task_switch(void *cur_sp)
 
   t->t_task.t_state = TASK_STATE_RUNNING;
   cpu->sched.current = t;
+#ifdef ENABLE_SMP
+  cpu_thread_current_set(t);
+#endif
   irq_permit(q);
 
+  if(t != curthread)
+    trace_event(TRACE_SWITCH, 0, curthread, t);
+
 #ifdef ENABLE_TASK_ACCOUNTING
   t->t_cycle_enter = cpu_cycle_counter();
   t->t_ctx_switches_acc++;
@@ -239,14 +366,130 @@ thread_retain(thread_t *t)
 
 
 
+#ifdef ENABLE_STACK_POOL
+
+/*
+ * Stack pool
+ *
+ * Threads created with TASK_STACK_POOL get their memory block rounded
+ * up to a power of two or 1.5 times one (the extra becomes stack). The
+ * half steps keep e.g. a 1kB stack with FPU context and thread_t out
+ * of the 2kB class. When the thread is
+ * gone the block is kept per size class and handed out again without
+ * going through the heap. Only the part that was used, as found by
+ * the stack usage scan, is repainted with 0xbb on reuse.
+ */
+
+#define STACK_POOL_MIN_SHIFT 9 // 512 bytes
+#define STACK_POOL_CLASSES   9 // 512, 768, 1k, 1.5k, .. 8kB
+#define STACK_POOL_CLASS_SIZE(c) \
+  (((c) & 1 ? 3 : 2) << ((c) / 2 + STACK_POOL_MIN_SHIFT - 1))
+
+#ifndef STACK_POOL_DEPTH
+#define STACK_POOL_DEPTH 4 // Blocks kept per class
+#endif
+
+typedef struct stack_pool_block {
+  SLIST_ENTRY(stack_pool_block) spb_link;
+  uint32_t spb_dirty; // Bytes at the top that must be repainted
+} stack_pool_block_t;
+
+static struct {
+  SLIST_HEAD(, stack_pool_block) sp_free;
+  uint8_t sp_count;
+  uint32_t sp_hits;
+  uint32_t sp_misses;
+} stack_pool[STACK_POOL_CLASSES];
+
+static uint8_t stack_pool_bypass; // Set by thread-bench for comparison
+
+static void *thread_stack_top(const thread_t *t);
+
+static uint32_t thread_stack_update(thread_t *t);
+
+
+// Returns -1 if size is not handled by the pool
+static int
+stack_pool_class(size_t size)
+{
+  if(size <= STACK_POOL_CLASS_SIZE(0))
+    return 0;
+  const int shift = 32 - __builtin_clz(size - 1); // size <= 1 << shift
+  const int c = (shift - STACK_POOL_MIN_SHIFT) * 2 -
+    (size <= 3 << (shift - 2));
+  return c < STACK_POOL_CLASSES ? c : -1;
+}
+
+
+static void *
+stack_pool_alloc(int c)
+{
+  const size_t size = STACK_POOL_CLASS_SIZE(c);
+
+  int q = irq_forbid(IRQ_LEVEL_SCHED);
+  stack_pool_block_t *b = SLIST_FIRST(&stack_pool[c].sp_free);
+  if(b != NULL) {
+    SLIST_REMOVE_HEAD(&stack_pool[c].sp_free, spb_link);
+    stack_pool[c].sp_count--;
+    stack_pool[c].sp_hits++;
+  } else {
+    stack_pool[c].sp_misses++;
+  }
+  irq_permit(q);
+
+  if(b == NULL) {
+    void *p = xalloc(size, CPU_STACK_ALIGNMENT, MEM_MAY_FAIL);
+    if(p != NULL)
+      memset(p, 0xbb, size);
+    return p;
+  }
+
+  const uint32_t dirty = b->spb_dirty;
+  memset(b, 0xbb, sizeof(stack_pool_block_t));
+  memset((void *)b + size - dirty, 0xbb, dirty);
+  return b;
+}
+
+
+// Returns 0 if the pool took the stack. Thread must not be running
+static int
+stack_pool_put(thread_t *t)
+{
+  if(!(t->t_task.t_flags & TASK_STACK_POOL))
+    return 1;
+
+  void *bottom = t->t_sp_bottom;
+  const int c = stack_pool_class((void *)(t + 1) - bottom);
+  void *const used = thread_stack_top(t) - thread_stack_update(t);
+  const uint32_t dirty = bottom + STACK_POOL_CLASS_SIZE(c) - used;
+  stack_pool_block_t *b = bottom;
+
+  int q = irq_forbid(IRQ_LEVEL_SCHED);
+  const int full = stack_pool[c].sp_count == STACK_POOL_DEPTH;
+  if(full) {
+    // Give it back to the heap instead
+    t->t_task.t_flags &= ~TASK_STACK_POOL;
+  } else {
+    b->spb_dirty = dirty;
+    SLIST_INSERT_HEAD(&stack_pool[c].sp_free, b, spb_link);
+    stack_pool[c].sp_count++;
+  }
+  irq_permit(q);
+  return full;
+}
+
+#endif
+
+
 static void
 thread_exit2(task_t *ta)
 {
   thread_t *t = (thread_t *)ta;
-  if(free_try(t->t_sp_bottom)) {
-    // Failed to free (malloc mutex held, keep trying)
-    readyqueue_insert(curcpu(), ta, "zombie");
-  }
+#ifdef ENABLE_STACK_POOL
+  if(!stack_pool_put(t))
+    return;
+#endif
+  free_deferred(t->t_sp_bottom);
 }
 
 static void
@@ -260,6 +503,19 @@ thread_release(thread_t *t)
   t->t_task.t_flags &= ~TASK_THREAD;
   t->t_task.t_run = thread_exit2;
   t->t_task.t_prio = 1;
+#ifdef ENABLE_SMP
+  if(task_is_on_cpu(&t->t_task)) {
+    // Still executing its last instructions, task_switch() on that
+    // CPU will queue it for reaping once it has switched away
+    t->t_task.t_state = TASK_STATE_ZOMBIE;
+    return;
+  }
+#endif
+#ifdef ENABLE_STACK_POOL
+  // Not executing on it, so the stack can be recycled right away
+  if(t != thread_current() && !stack_pool_put(t))
+    return;
+#endif
   readyqueue_insert(cpu, &t->t_task, "zombie");
 }
 
@@ -303,9 +559,8 @@ thread_join(thread_t *t)
   while(t->t_task.t_state != TASK_STATE_ZOMBIE)
     task_sleep(&join_wait);
 
-  irq_permit(s);
-
   thread_release(t);
+  irq_permit(s);
   return NULL;
 }
 
@@ -314,8 +569,6 @@ thread_t *
 thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
               const char *name, int flags, unsigned int prio)
 {
-  cpu_t *cpu = curcpu();
-
   prio &= TASK_PRIO_MASK;
   if(prio == 0)
     prio = 1;
@@ -323,6 +576,10 @@ thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
   if(stack_size < MIN_STACK_SIZE)
     stack_size = MIN_STACK_SIZE;
 
+  // Keep thread_t aligned, mutex_t stores flags in the low bits
+  // of the owner pointer
+  stack_size = (stack_size + 7) & ~7;
+
   size_t fpu_ctx_size = 0;
 #ifdef HAVE_FPU
   if(flags & TASK_FPU) {
@@ -330,13 +587,30 @@ thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
   }
 #endif
 
-  void *sp_bottom = xalloc(stack_size + fpu_ctx_size + sizeof(thread_t),
-                           CPU_STACK_ALIGNMENT, MEM_MAY_FAIL |
-                           (flags & TASK_DMA_STACK ? MEM_TYPE_DMA : 0));
+  const size_t total = stack_size + fpu_ctx_size + sizeof(thread_t);
+  void *sp_bottom;
+
+#ifdef ENABLE_STACK_POOL
+  const int pool_class =
+    flags & TASK_STACK_POOL && !(flags & TASK_DMA_STACK) &&
+    !stack_pool_bypass ? stack_pool_class(total) : -1;
+
+  if(pool_class >= 0) {
+    sp_bottom = stack_pool_alloc(pool_class);
+    stack_size = (STACK_POOL_CLASS_SIZE(pool_class) -
+                  fpu_ctx_size - sizeof(thread_t)) & ~7;
+  } else
+#endif
+  {
+    flags &= ~TASK_STACK_POOL;
+    sp_bottom = xalloc(total, CPU_STACK_ALIGNMENT, MEM_MAY_FAIL |
+                       (flags & TASK_DMA_STACK ? MEM_TYPE_DMA : 0));
+    if(sp_bottom != NULL)
+      memset(sp_bottom, 0xbb, total);
+  }
   if(sp_bottom == NULL)
     return NULL;
 
-  memset(sp_bottom, 0xbb, stack_size + fpu_ctx_size + sizeof(thread_t));
   void *sp = sp_bottom + stack_size;
   thread_t *t = sp + fpu_ctx_size;
 
@@ -347,12 +621,20 @@ thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
 
   strlcpy(t->t_name, name, sizeof(t->t_name));
   t->t_refcount = 1;
+  t->t_base_prio = prio;
+  t->t_mutex_wait = NULL;
+  SLIST_INIT(&t->t_mutexes);
+  t->t_periodic = NULL;
+  t->t_stack_peak = 0;
 
 #ifdef ENABLE_TASK_ACCOUNTING
   t->t_cycle_acc = 0;
   t->t_load = 0;
   t->t_ctx_switches = 0;
   t->t_ctx_switches_acc = 0;
+#ifdef ENABLE_LOAD_HISTORY
+  memset(&t->t_load_history, 0, sizeof(t->t_load_history));
+#endif
 #endif
 
 #ifdef HAVE_FPU
@@ -368,14 +650,13 @@ thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
   t->t_sp_bottom = sp_bottom;
 
   task_t *task = &t->t_task;
-  task->t_state = TASK_STATE_READY;
+  task->t_state = TASK_STATE_NONE;
   task->t_prio = prio;
   task->t_flags = flags | TASK_THREAD;
   task->t_run = NULL;
 
   int s = irq_forbid(IRQ_LEVEL_SCHED);
-  STAILQ_INSERT_TAIL(&cpu->sched.readyqueue[task->t_prio], task, t_ready_link);
-  cpu->sched.active_queues |= 1 << task->t_prio;
+  readyqueue_insert(curcpu(), task, "create");
   SLIST_INSERT_HEAD(&allthreads, t, t_global_link);
   irq_permit(s);
 
@@ -384,6 +665,52 @@ thread_create(void *(*entry)(void *arg), void *arg, size_t stack_size,
 }
 
 
+/*
+ * task_wait_any() puts a proxy task (flagged TASK_WAITER) on each
+ * waitable. When one of them is woken it records which one fired,
+ * unlinks all its siblings and the wakeup is passed on to the thread
+ */
+
+struct task_waiter;
+
+typedef struct wait_any {
+  thread_t *wa_thread;
+  struct task_waiter *wa_set;
+  size_t wa_count;
+  int wa_fired;
+} wait_any_t;
+
+typedef struct task_waiter {
+  task_t tw_task;
+  wait_any_t *tw_wa;
+} task_waiter_t;
+
+
+static void
+wait_any_unlink(wait_any_t *wa)
+{
+  for(size_t i = 0; i < wa->wa_count; i++) {
+    task_t *t = &wa->wa_set[i].tw_task;
+    if(t->t_state == TASK_STATE_SLEEPING) {
+      LIST_REMOVE(t, t_wait_link);
+      t->t_state = TASK_STATE_NONE;
+    }
+  }
+}
+
+
+// Called with proxy already removed from its list, returns the thread
+static task_t *
+wait_any_fire(task_waiter_t *tw)
+{
+  wait_any_t *wa = tw->tw_wa;
+  tw->tw_task.t_state = TASK_STATE_NONE;
+  wa->wa_fired = tw - wa->wa_set;
+  wait_any_unlink(wa);
+  return &wa->wa_thread->t_task;
+}
+
+
 void
 task_wakeup_sched_locked(task_waitable_t *waitable, int all)
 {
@@ -392,9 +719,18 @@ task_wakeup_sched_locked(task_waitable_t *waitable, int all)
   while((t = LIST_FIRST(&waitable->list)) != NULL) {
     assert(t->t_state == TASK_STATE_SLEEPING);
     LIST_REMOVE(t, t_wait_link);
+    if(t->t_flags & TASK_CORO) {
+      coro_wakeup_sched_locked(t);
+      if(!all)
+        break;
+      continue;
+    }
+    if(t->t_flags & TASK_WAITER)
+      t = wait_any_fire((task_waiter_t *)t);
     cpu_t *cpu = curcpu();
+    trace_event(TRACE_WAKEUP, 0, t, cpu->sched.current);
 
-    if(t != &cpu->sched.current->t_task) {
+    if(!task_is_on_cpu(t)) {
       if(t->t_prio >= cpu->sched.current->t_task.t_prio) {
         do_sched = 1;
       }
@@ -455,7 +791,7 @@ task_sleep_abs_sched_locked_timeout(void *opaque, uint64_t expire)
     LIST_REMOVE(t, t_wait_link);
 
     cpu_t *cpu = curcpu();
-    if(t != &cpu->sched.current->t_task) {
+    if(!task_is_on_cpu(t)) {
       readyqueue_insert(cpu, t, "sleep-timo");
     } else {
       t->t_state = TASK_STATE_RUNNING;
@@ -566,6 +902,89 @@ task_sleep_deadline(task_waitable_t *waitable, int64_t deadline)
 
 
 
+static void
+task_wait_any_timeout(void *opaque, uint64_t expire)
+{
+  wait_any_t *wa = opaque;
+  task_t *t = &wa->wa_thread->t_task;
+
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+
+  if(t->t_state == TASK_STATE_SLEEPING) {
+    wait_any_unlink(wa);
+
+    cpu_t *cpu = curcpu();
+    if(!task_is_on_cpu(t)) {
+      readyqueue_insert(cpu, t, "waitany-timo");
+    } else {
+      t->t_state = TASK_STATE_RUNNING;
+    }
+    schedule();
+  }
+  irq_permit(s);
+}
+
+
+int
+task_wait_any_sched_locked(task_waitable_t *const *waitables, size_t count,
+                           int64_t deadline)
+{
+  thread_t *const cur = thread_current();
+  task_waiter_t set[count ?: 1];
+  wait_any_t wa = {
+    .wa_thread = cur,
+    .wa_set = set,
+    .wa_count = count,
+    .wa_fired = -1,
+  };
+  timer_t timer;
+
+  assert(count || deadline);
+  assert(cur->t_task.t_state == TASK_STATE_RUNNING);
+  cur->t_task.t_state = TASK_STATE_SLEEPING;
+#ifdef ENABLE_TASK_WCHAN
+  cur->t_wchan = "wait_any";
+#endif
+
+  for(size_t i = 0; i < count; i++) {
+    task_waiter_t *tw = &set[i];
+    tw->tw_task.t_flags = TASK_WAITER;
+    tw->tw_task.t_prio = cur->t_task.t_prio;
+    tw->tw_task.t_state = TASK_STATE_SLEEPING;
+    tw->tw_wa = &wa;
+    task_insert_wait_list(waitables[i], &tw->tw_task);
+  }
+
+  if(deadline) {
+    timer.t_cb = task_wait_any_timeout;
+    timer.t_opaque = &wa;
+    timer.t_expire = 0;
+    timer.t_name = cur->t_name;
+    timer_arm_abs(&timer, deadline);
+  }
+
+  while(cur->t_task.t_state == TASK_STATE_SLEEPING) {
+    schedule();
+    irq_permit(irq_lower());
+  }
+
+  if(deadline)
+    timer_disarm(&timer);
+  return wa.wa_fired;
+}
+
+
+int
+task_wait_any(task_waitable_t *const *waitables, size_t count,
+              int64_t deadline)
+{
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+  const int r = task_wait_any_sched_locked(waitables, count, deadline);
+  irq_permit(s);
+  return r;
+}
+
+
 static void
 task_sleep_until_timeout(void *opaque, uint64_t expire)
 {
@@ -574,7 +993,7 @@ task_sleep_until_timeout(void *opaque, uint64_t expire)
 
   assert(t->t_state == TASK_STATE_SLEEPING);
   cpu_t *cpu = curcpu();
-  if(t != &cpu->sched.current->t_task) {
+  if(!task_is_on_cpu(t)) {
     readyqueue_insert(cpu, t, "sleep-timo2");
   } else {
     t->t_state = TASK_STATE_RUNNING;
@@ -634,10 +1053,331 @@ sleep(unsigned int sec)
 }
 
 
+/*
+ * Periodic threads
+ *
+ * Execution time is wall time from release to return of fn so it
+ * includes time spent preempted. Stats are updated with
+ * IRQ_LEVEL_SCHED blocked so ps and RPC get a consistent view
+ */
+
+typedef struct thread_periodic {
+  int (*tp_fn)(void *arg);
+  void *tp_arg;
+  uint64_t tp_release;
+  uint32_t tp_period;
+  uint32_t tp_deadline;
+
+  uint64_t tp_exec_sum;
+  uint32_t tp_exec_min;
+  uint32_t tp_exec_max;
+  uint32_t tp_activations;
+  uint32_t tp_missed;
+} thread_periodic_t;
+
+
+static void *
+thread_periodic_entry(void *arg)
+{
+  thread_t *const cur = thread_current();
+
+  // Keep state on our own stack, it's freed together with thread_t
+  thread_periodic_t tp = *(thread_periodic_t *)arg;
+  free(arg);
+
+  int q = irq_forbid(IRQ_LEVEL_SCHED);
+  cur->t_periodic = &tp;
+  irq_permit(q);
+
+  while(1) {
+    sleep_until(tp.tp_release);
+
+    const int stop = tp.tp_fn(tp.tp_arg);
+    const uint64_t end = clock_get();
+    const uint32_t exec = end - tp.tp_release;
+
+    q = irq_forbid(IRQ_LEVEL_SCHED);
+    tp.tp_activations++;
+    tp.tp_exec_sum += exec;
+    if(exec < tp.tp_exec_min)
+      tp.tp_exec_min = exec;
+    if(exec > tp.tp_exec_max)
+      tp.tp_exec_max = exec;
+    if(end > tp.tp_release + tp.tp_deadline)
+      tp.tp_missed++;
+
+    tp.tp_release += tp.tp_period;
+    while(tp.tp_release <= end) {
+      // Overran into next period(s), skip those releases
+      tp.tp_release += tp.tp_period;
+      tp.tp_missed++;
+    }
+    if(stop)
+      cur->t_periodic = NULL;
+    irq_permit(q);
+
+    if(stop)
+      return NULL;
+  }
+}
+
+
+thread_t *
+thread_create_periodic(int (*fn)(void *arg), void *arg, size_t stack_size,
+                       const char *name, int flags, unsigned int prio,
+                       uint32_t period, uint32_t phase, uint32_t deadline)
+{
+  if(period == 0)
+    return NULL;
+
+  thread_periodic_t *tp = xalloc(sizeof(thread_periodic_t), 0, MEM_MAY_FAIL);
+  if(tp == NULL)
+    return NULL;
+
+  memset(tp, 0, sizeof(thread_periodic_t));
+  tp->tp_fn = fn;
+  tp->tp_arg = arg;
+  tp->tp_release = clock_get() + phase;
+  tp->tp_period = period;
+  tp->tp_deadline = deadline ?: period;
+  tp->tp_exec_min = UINT32_MAX;
+
+  thread_t *t = thread_create(thread_periodic_entry, tp, stack_size, name,
+                              flags, prio);
+  if(t == NULL)
+    free(tp);
+  return t;
+}
+
+
+/*
+ * Priority inheritance
+ *
+ * A thread blocking on a mutex raises the owner's priority to its own,
+ * and if the owner is itself blocked on a mutex we continue down the
+ * chain. When a contended mutex is released the owner's priority is
+ * recomputed from its base priority and the top waiter of every other
+ * contended mutex it still holds
+ */
+
+#define MUTEX_PI_MAX_DEPTH 8
+
+// Return the CPU on whose readyqueue a task in READY state is queued
+static cpu_t *
+task_readyqueue_cpu(task_t *t)
+{
+#ifdef ENABLE_SMP
+  for(int i = 0; i < CPU_MAX; i++) {
+    if(task_is_on_queue(t, &cpus[i].sched.readyqueue[t->t_prio]))
+      return &cpus[i];
+  }
+  return NULL;
+#else
+  return curcpu();
+#endif
+}
+
+
+static void
+thread_set_prio_sched_locked(thread_t *t, int prio)
+{
+  task_t *const task = &t->t_task;
+
+  if(task->t_state == TASK_STATE_READY) {
+    cpu_t *cpu = task_readyqueue_cpu(task);
+    if(cpu != NULL) {
+      struct task_queue *q = &cpu->sched.readyqueue[task->t_prio];
+      STAILQ_REMOVE(q, task, task, t_ready_link);
+      if(STAILQ_FIRST(q) == NULL)
+        cpu->sched.active_queues &= ~(1 << task->t_prio);
+      task->t_state = TASK_STATE_NONE;
+      task->t_prio = prio;
+      readyqueue_insert(cpu, task, "prio");
+      if(prio > cpu->sched.current->t_task.t_prio)
+        schedule();
+      return;
+    }
+  }
+
+  if(task->t_state == TASK_STATE_SLEEPING && t->t_mutex_wait != NULL) {
+    // Keep the wait list sorted
+    LIST_REMOVE(task, t_wait_link);
+    task->t_prio = prio;
+    task_insert_wait_list(&t->t_mutex_wait->waiters, task);
+    return;
+  }
+
+  task->t_prio = prio;
+}
+
+
+static void
+mutex_inherit_prio(mutex_t *m, int prio)
+{
+  for(int i = 0; i < MUTEX_PI_MAX_DEPTH && m != NULL; i++) {
+    thread_t *owner = mutex_owner(m);
+    if(owner == NULL || owner->t_task.t_prio >= prio)
+      return;
+    thread_set_prio_sched_locked(owner, prio);
+    m = owner->t_task.t_state == TASK_STATE_SLEEPING ?
+      owner->t_mutex_wait : NULL;
+  }
+}
+
+
+static void
+thread_update_prio(thread_t *t)
+{
+  int prio = t->t_base_prio;
+  const mutex_t *m;
+  SLIST_FOREACH(m, &t->t_mutexes, link) {
+    const task_t *w = LIST_FIRST(&m->waiters.list);
+    if(w != NULL && w->t_prio > prio)
+      prio = w->t_prio;
+  }
+  if(prio != t->t_task.t_prio)
+    thread_set_prio_sched_locked(t, prio);
+}
+
+
+#ifdef ENABLE_MUTEX_STATS
+
+/*
+ * Per lock statistics, aggregated over all mutexes with the same name.
+ * Updated with IRQ_LEVEL_SCHED blocked. Names are compared by pointer
+ * which is fine as they are almost always string literals
+ */
+
+#define MUTEX_STATS_SLOTS 64
+
+typedef struct {
+  const char *name;
+  uint32_t acquisitions;
+  uint32_t contended;
+  uint64_t wait_total;
+  uint32_t wait_max;
+  uint32_t hold_max;
+} mutex_stats_t;
+
+static mutex_stats_t mutex_stats[MUTEX_STATS_SLOTS];
+static uint32_t mutex_stats_dropped;
+
+static inline uint32_t
+mutex_stats_now(void)
+{
+#ifdef ENABLE_TASK_ACCOUNTING
+  return cpu_cycle_counter();
+#else
+  return clock_get_irq_blocked();
+#endif
+}
+
+
+static mutex_stats_t *
+mutex_stats_get(const mutex_t *m)
+{
+#ifdef ENABLE_TASK_WCHAN
+  const char *name = m->waiters.name ?: "<unnamed>";
+#else
+  const char *name = "<all>";
+#endif
+  const uint32_t h = ((uintptr_t)name >> 2) * 0x9e3779b1;
+
+  for(int i = 0; i < MUTEX_STATS_SLOTS; i++) {
+    mutex_stats_t *ms = &mutex_stats[(h + i) % MUTEX_STATS_SLOTS];
+    if(ms->name == name)
+      return ms;
+    if(ms->name == NULL) {
+      ms->name = name;
+      return ms;
+    }
+  }
+  mutex_stats_dropped++;
+  return NULL;
+}
+
+
+static void
+mutex_stats_acquired(mutex_t *m, uint32_t start, int contended)
+{
+  const uint32_t now = mutex_stats_now();
+  m->acquired = now;
+  mutex_stats_t *ms = mutex_stats_get(m);
+  if(ms == NULL)
+    return;
+  ms->acquisitions++;
+  if(contended) {
+    const uint32_t wait = now - start;
+    ms->contended++;
+    ms->wait_total += wait;
+    if(wait > ms->wait_max)
+      ms->wait_max = wait;
+  }
+}
+
+
+static void
+mutex_stats_released(const mutex_t *m)
+{
+  const uint32_t hold = mutex_stats_now() - m->acquired;
+  mutex_stats_t *ms = mutex_stats_get(m);
+  if(ms != NULL && hold > ms->hold_max)
+    ms->hold_max = hold;
+}
+
+
+static error_t
+cmd_locks(cli_t *cli, int argc, char **argv)
+{
+  const int reset = argc > 1 && !strcmp(argv[1], "reset");
+
+#ifdef ENABLE_TASK_ACCOUNTING
+  const char *unit = "cycles";
+#else
+  const char *unit = "us";
+#endif
+
+  cli_printf(cli, "Name              Acquired Contended   "
+             "Avg wait   Max wait   Max hold (%s)\n", unit);
+  for(int i = 0; i < MUTEX_STATS_SLOTS; i++) {
+    int q = irq_forbid(IRQ_LEVEL_SCHED);
+    const mutex_stats_t ms = mutex_stats[i];
+    if(reset)
+      memset(&mutex_stats[i], 0, sizeof(mutex_stats_t));
+    irq_permit(q);
+
+    if(ms.name == NULL)
+      continue;
+    cli_printf(cli, "%-16.16s %9u %9u %10u %10u %10u\n",
+               ms.name, (unsigned int)ms.acquisitions,
+               (unsigned int)ms.contended,
+               (unsigned int)(ms.contended ?
+                              ms.wait_total / ms.contended : 0),
+               (unsigned int)ms.wait_max, (unsigned int)ms.hold_max);
+  }
+  if(mutex_stats_dropped)
+    cli_printf(cli, "%u lock operations not tracked (table full)\n",
+               (unsigned int)mutex_stats_dropped);
+  if(reset)
+    mutex_stats_dropped = 0;
+  return 0;
+}
+
+CLI_CMD_DEF("locks", cmd_locks);
+
+#endif
+
+
 static void
 mutex_lock_sched_locked(mutex_t *m, task_t *curtask)
 {
-  while(m->lock & 1) {
+  thread_t *const curthread = (thread_t *)curtask;
+#ifdef ENABLE_MUTEX_STATS
+  const uint32_t start = mutex_stats_now();
+  const int contended = m->lock != 0;
+#endif
+
+  while(m->lock) {
 
 #ifdef ENABLE_TASK_DEBUG
     if(task_is_on_readyqueue(curcpu(), curtask)) {
@@ -646,32 +1386,50 @@ mutex_lock_sched_locked(mutex_t *m, task_t *curtask)
     }
 #endif
 
+    if(curtask->t_state != TASK_STATE_SLEEPING) {
+
 #ifdef ENABLE_TASK_DEBUG
-    m->lock &= ~1;
-    if(task_is_on_list(curtask, &m->waiters.list)) {
-      panic("%s: Task %p is already on wait queue",
-            __FUNCTION__, curtask);
-    }
-    m->lock |= 1;
+      if(task_is_on_list(curtask, &m->waiters.list)) {
+        panic("%s: Task %p is already on wait queue",
+              __FUNCTION__, curtask);
+      }
 #endif
 
-    if(curtask->t_state != TASK_STATE_SLEEPING) {
       curtask->t_state = TASK_STATE_SLEEPING;
 #ifdef ENABLE_TASK_WCHAN
-      thread_t *curthread = (thread_t *)curtask;
       curthread->t_wchan = m->waiters.name ?: __FUNCTION__;
 #endif
-      // We need to clear the lockbit or list manipulation will fail
-      // as they share the same memory address
-      m->lock &= ~1;
+      curthread->t_mutex_wait = m;
       task_insert_wait_list(&m->waiters, curtask);
-      m->lock |= 1;
+      trace_event(TRACE_MUTEX_BLOCK, 0, m, mutex_owner(m));
+
+      if(!(m->lock & MUTEX_CONTENDED)) {
+        m->lock |= MUTEX_CONTENDED;
+        thread_t *owner = mutex_owner(m);
+        if(owner != NULL)
+          SLIST_INSERT_HEAD(&owner->t_mutexes, m, link);
+      }
+      mutex_inherit_prio(m, curtask->t_prio);
     }
 
     schedule();
     irq_permit(irq_lower());
   }
-  m->lock |= 1;
+
+  curthread->t_mutex_wait = NULL;
+  m->lock = (intptr_t)curthread | MUTEX_LOCKED;
+#ifdef ENABLE_MUTEX_STATS
+  mutex_stats_acquired(m, start, contended);
+#endif
+
+  const task_t *w = LIST_FIRST(&m->waiters.list);
+  if(w != NULL) {
+    // More waiters queued up behind us, they now boost us instead
+    m->lock |= MUTEX_CONTENDED;
+    SLIST_INSERT_HEAD(&curthread->t_mutexes, m, link);
+    if(w->t_prio > curtask->t_prio)
+      thread_set_prio_sched_locked(curthread, w->t_prio);
+  }
 }
 
 
@@ -690,9 +1448,12 @@ int
 mutex_trylock_slow(mutex_t *m)
 {
   const int s = irq_forbid(IRQ_LEVEL_SCHED);
-  int r = m->lock & 1;
+  int r = !!m->lock;
   if(!r) {
-    m->lock |= 1;
+    m->lock = (intptr_t)thread_current() | MUTEX_LOCKED;
+#ifdef ENABLE_MUTEX_STATS
+    mutex_stats_acquired(m, 0, 0);
+#endif
   }
   irq_permit(s);
   return r;
@@ -705,7 +1466,19 @@ mutex_unlock_sched_locked(mutex_t *m)
 {
   assert(m->lock != 0);
 
-  m->lock &= ~1;
+#ifdef ENABLE_MUTEX_STATS
+  mutex_stats_released(m);
+#endif
+
+  if(m->lock & MUTEX_CONTENDED) {
+    thread_t *owner = mutex_owner(m);
+    if(owner != NULL) {
+      SLIST_REMOVE(&owner->t_mutexes, m, mutex, link);
+      thread_update_prio(owner);
+    }
+  }
+
+  m->lock = 0;
 
   task_t *t = LIST_FIRST(&m->waiters.list);
   if(t != NULL) {
@@ -713,6 +1486,11 @@ mutex_unlock_sched_locked(mutex_t *m)
     task_t *const cur = &cpu->sched.current->t_task;
 
     LIST_REMOVE(t, t_wait_link);
+    if(task_is_on_cpu(t)) {
+      // Not yet switched away on another CPU
+      t->t_state = TASK_STATE_RUNNING;
+      return;
+    }
     readyqueue_insert(cpu, t, "mutex_unlock");
     if(t->t_prio >= cur->t_prio)
       schedule();
@@ -766,10 +1544,72 @@ cond_wait_timeout(cond_t *c, mutex_t *m, uint64_t deadline)
 }
 
 
+void
+rwlock_init(rwlock_t *rw, const char *name)
+{
+  task_waitable_init(&rw->rw_readers, name);
+  task_waitable_init(&rw->rw_writers, name);
+  rw->rw_count = 0;
+  rw->rw_writers_waiting = 0;
+}
+
+
+void
+rwlock_rdlock(rwlock_t *rw)
+{
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+  while(rw->rw_count < 0 || rw->rw_writers_waiting)
+    task_sleep_sched_locked(&rw->rw_readers);
+  rw->rw_count++;
+  irq_permit(s);
+}
+
+
+void
+rwlock_rdunlock(rwlock_t *rw)
+{
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+  assert(rw->rw_count > 0);
+  if(--rw->rw_count == 0)
+    task_wakeup_sched_locked(&rw->rw_writers, 0);
+  irq_permit(s);
+}
+
+
+void
+rwlock_wrlock(rwlock_t *rw)
+{
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+  rw->rw_writers_waiting++;
+  while(rw->rw_count != 0)
+    task_sleep_sched_locked(&rw->rw_writers);
+  rw->rw_writers_waiting--;
+  rw->rw_count = -1;
+  irq_permit(s);
+}
+
+
+void
+rwlock_wrunlock(rwlock_t *rw)
+{
+  const int s = irq_forbid(IRQ_LEVEL_SCHED);
+  assert(rw->rw_count == -1);
+  rw->rw_count = 0;
+  if(rw->rw_writers_waiting)
+    task_wakeup_sched_locked(&rw->rw_writers, 0);
+  else
+    task_wakeup_sched_locked(&rw->rw_readers, 1);
+  irq_permit(s);
+}
+
+
 void
 sched_cpu_init(sched_cpu_t *sc, thread_t *idle)
 {
   idle->t_task.t_flags = TASK_THREAD;
+  idle->t_base_prio = idle->t_task.t_prio;
+  idle->t_mutex_wait = NULL;
+  SLIST_INIT(&idle->t_mutexes);
   sc->idle = &idle->t_task;
   sc->current = idle;
 #ifdef HAVE_FPU
@@ -810,10 +1650,232 @@ thread_get_next(thread_t *cur)
   return t;
 }
 
+#if defined(ENABLE_TRACE) || defined(ENABLE_PERF)
+int
+thread_get_name(const void *p, char *buf, size_t len)
+{
+  thread_t *t;
+  int r = -1;
+  int q = irq_forbid(IRQ_LEVEL_SWITCH);
+
+  if(p == curcpu()->sched.idle) {
+    strlcpy(buf, ((const thread_t *)p)->t_name, len);
+    r = 0;
+  } else {
+    SLIST_FOREACH(t, &allthreads, t_global_link) {
+      if(t == p) {
+        strlcpy(buf, t->t_name, len);
+        r = 0;
+        break;
+      }
+    }
+  }
+  irq_permit(q);
+  return r;
+}
+#endif
+
+
+/*
+ * Stack usage
+ *
+ * Stacks are filled with 0xbb when created and peak usage is found by
+ * scanning up from the bottom for the first overwritten word. Usage
+ * only grows so each scan stops where the previous one ended.
+ * The redzone (if any) is not scanned and not counted as usable stack
+ */
+
+#ifdef CPU_STACK_REDZONE_SIZE
+#define STACK_SCAN_SKIP CPU_STACK_REDZONE_SIZE
+#else
+#define STACK_SCAN_SKIP 0
+#endif
+
+static void *
+thread_stack_top(const thread_t *t)
+{
+#ifdef HAVE_FPU
+  if(t->t_fpuctx)
+    return t->t_fpuctx;
+#endif
+  return (void *)t;
+}
+
+
+static size_t
+thread_stack_size(const thread_t *t)
+{
+  return thread_stack_top(t) - (t->t_sp_bottom + STACK_SCAN_SKIP);
+}
+
+
+static uint32_t
+thread_stack_update(thread_t *t)
+{
+  void *const top = thread_stack_top(t);
+  const uint32_t *p = t->t_sp_bottom + STACK_SCAN_SKIP;
+  const uint32_t *end = top - t->t_stack_peak;
+
+  while(p < end && *p == 0xbbbbbbbb)
+    p++;
+
+  const uint32_t peak = top - (void *)p;
+  if(peak > t->t_stack_peak)
+    t->t_stack_peak = peak;
+  return t->t_stack_peak;
+}
+
+
+static error_t
+cmd_stacks(cli_t *cli, int argc, char **argv)
+{
+  cli_printf(cli, " Name             Size   Peak   Free  Suggested\n");
+
+  thread_t *t = NULL;
+  while((t = thread_get_next(t)) != NULL) {
+    const size_t size = thread_stack_size(t);
+    const uint32_t peak = thread_stack_update(t);
+
+    // 25% headroom for paths not yet taken, redzone is on top of that
+    size_t suggest = (peak + peak / 4 + STACK_SCAN_SKIP + 7) & ~7;
+    if(suggest < MIN_STACK_SIZE)
+      suggest = MIN_STACK_SIZE;
+
+    cli_printf(cli, " %-14s %6d %6d %6d %10d%s\n",
+               t->t_name, (int)size, (int)peak, (int)(size - peak),
+               (int)suggest,
+               peak >= size ? "  Overflowed" : "");
+  }
+
+#ifdef ENABLE_STACK_POOL
+  cli_printf(cli, "\n Pool   Free   Hits Misses\n");
+  for(int c = 0; c < STACK_POOL_CLASSES; c++) {
+    cli_printf(cli, " %5d %5d %6d %6d\n", STACK_POOL_CLASS_SIZE(c),
+               stack_pool[c].sp_count, (int)stack_pool[c].sp_hits,
+               (int)stack_pool[c].sp_misses);
+  }
+#endif
+  return 0;
+}
+
+CLI_CMD_DEF("stacks", cmd_stacks);
+
+
+#ifdef ENABLE_STACK_POOL
+
+static void *
+thread_bench_entry(void *arg)
+{
+  return NULL;
+}
+
+
+// Create/join latency with stacks from the heap and from the pool
+static error_t
+cmd_thread_bench(cli_t *cli, int argc, char **argv)
+{
+  const int count = argc > 1 ? atoi(argv[1]) : 100;
+  const int prio = thread_current()->t_base_prio;
+  if(count < 1)
+    return ERR_INVALID_ARGS;
+
+  for(int pool = 0; pool < 2; pool++) {
+    stack_pool_bypass = !pool;
+    const int64_t start = clock_get();
+    for(int i = 0; i < count; i++) {
+      thread_t *t = thread_create(thread_bench_entry, NULL, 1024, "bench",
+                                  TASK_STACK_POOL, prio);
+      if(t == NULL) {
+        stack_pool_bypass = 0;
+        return ERR_NO_MEMORY;
+      }
+      thread_join(t);
+    }
+    const int64_t elapsed = clock_get() - start;
+    cli_printf(cli, "%s: %d us per create/join\n",
+               pool ? "Pool" : "Heap", (int)(elapsed / count));
+  }
+  stack_pool_bypass = 0;
+  return 0;
+}
+
+CLI_CMD_DEF("thread-bench", cmd_thread_bench);
+
+#endif
+
+
+#ifdef STACK_LOW_WATERMARK
+
+// Log a warning when a thread has less than STACK_LOW_WATERMARK bytes
+// of its stack left
+
+static void *
+stack_monitor_thread(void *arg)
+{
+  while(1) {
+    thread_t *t = NULL;
+    while((t = thread_get_next(t)) != NULL) {
+      const int avail = thread_stack_size(t) - thread_stack_update(t);
+      if(avail >= STACK_LOW_WATERMARK ||
+         t->t_task.t_flags & TASK_STACK_LOW)
+        continue;
+
+      int q = irq_forbid(IRQ_LEVEL_SCHED);
+      t->t_task.t_flags |= TASK_STACK_LOW;
+      irq_permit(q);
+      evlog(LOG_WARNING, "%s: Low on stack, %d bytes left",
+            t->t_name, avail);
+    }
+    sleep(1);
+  }
+  return NULL;
+}
+
+
+static void __attribute__((constructor(900)))
+stack_monitor_init(void)
+{
+  thread_create(stack_monitor_thread, NULL, 512, "stackmon",
+                TASK_DETACHED, 1);
+}
+#endif
+
+
 #ifdef ENABLE_TASK_ACCOUNTING
 
 static uint32_t prev_cc;
 
+#ifdef ENABLE_LOAD_HISTORY
+
+static load_history_t load_history_idle;
+static uint32_t load_history_seconds;
+
+static void
+load_history_add(load_history_t *lh, uint32_t load)
+{
+  const uint32_t n = load_history_seconds;
+  lh->lh_sec[n % LOAD_HISTORY_SECONDS] = load;
+  lh->lh_min_acc += load;
+  if(n % 60 == 59) {
+    lh->lh_min[(n / 60) % LOAD_HISTORY_MINUTES] = lh->lh_min_acc / 60;
+    lh->lh_min_acc = 0;
+  }
+}
+
+
+uint32_t
+load_history_get(const thread_t *t, load_history_t *lh)
+{
+  // Blocks accounting_run()
+  int q = irq_forbid(IRQ_LEVEL_SWITCH);
+  *lh = t ? t->t_load_history : load_history_idle;
+  const uint32_t n = load_history_seconds;
+  irq_permit(q);
+  return n;
+}
+
+#endif
+
 static void
 accounting_run(task_t *t_)
 {
@@ -828,7 +1890,20 @@ accounting_run(task_t *t_)
     t->t_cycle_acc = 0;
     t->t_ctx_switches = t->t_ctx_switches_acc;
     t->t_ctx_switches_acc = 0;
+    thread_stack_update(t);
+#ifdef ENABLE_LOAD_HISTORY
+    load_history_add(&t->t_load_history, t->t_load);
+#endif
   }
+
+#ifdef ENABLE_LOAD_HISTORY
+  // The idle thread is not on allthreads
+  t = (thread_t *)curcpu()->sched.idle;
+  load_history_add(&load_history_idle,
+                   cc_delta ? t->t_cycle_acc / cc_delta : 0);
+  t->t_cycle_acc = 0;
+  load_history_seconds++;
+#endif
 }
 
 static task_t accounting_task = {
@@ -866,7 +1941,7 @@ task_init_accounting(void)
 static error_t
 cmd_ps(cli_t *cli, int argc, char **argv)
 {
-  cli_printf(cli, " Name           Stack      Sp         Pri Sta "
+  cli_printf(cli, " Name           Stack      Sp          Peak/Size  Pri Sta  "
 #ifdef ENABLE_TASK_ACCOUNTING
              "CtxSwch Load "
 #endif
@@ -874,15 +1949,33 @@ cmd_ps(cli_t *cli, int argc, char **argv)
 
   thread_t *t = NULL;
   while((t = thread_get_next(t)) != NULL) {
-    cli_printf(cli, " %-14s %p %p %3d %c%c%c "
+
+    // Owner of the mutex we're blocked on (if any)
+    char owner[sizeof(t->t_name)] = {};
+    thread_periodic_t tp;
+    int s = irq_forbid(IRQ_LEVEL_SCHED);
+    if(t->t_task.t_state == TASK_STATE_SLEEPING && t->t_mutex_wait) {
+      const thread_t *o = mutex_owner(t->t_mutex_wait);
+      if(o != NULL)
+        strlcpy(owner, o->t_name, sizeof(owner));
+    }
+    const int periodic = t->t_periodic != NULL;
+    if(periodic)
+      tp = *t->t_periodic;
+    irq_permit(s);
+
+    const uint32_t stack_peak = thread_stack_update(t);
+
+    cli_printf(cli, " %-14s %p %p %5d/%-5d %3d %c%c%c%c "
 #ifdef ENABLE_TASK_ACCOUNTING
                "%-6d %3d.%-2d "
 #endif
 #ifdef ENABLE_TASK_WCHAN
                "%s"
 #endif
-               "\n",
+               "%s%s\n",
                t->t_name, t->t_sp_bottom, t->t_sp,
+               (int)stack_peak, (int)thread_stack_size(t),
                t->t_task.t_prio,
                "_RrSZ"[t->t_task.t_state],
 #ifdef HAVE_FPU
@@ -890,7 +1983,8 @@ cmd_ps(cli_t *cli, int argc, char **argv)
 #else
                ' ',
 #endif
-               (t->t_task.t_flags & TASK_DETACHED) ? 'd' : ' '
+               (t->t_task.t_flags & TASK_DETACHED) ? 'd' : ' ',
+               t->t_task.t_prio != t->t_base_prio ? 'i' : ' '
 #ifdef ENABLE_TASK_ACCOUNTING
                ,t->t_ctx_switches,
                t->t_load / 100,
@@ -899,7 +1993,18 @@ cmd_ps(cli_t *cli, int argc, char **argv)
 #ifdef ENABLE_TASK_WCHAN
                ,t->t_task.t_state == TASK_STATE_SLEEPING ? t->t_wchan : ""
 #endif
+               ,owner[0] ? " held by " : "", owner
                );
+
+    if(periodic) {
+      cli_printf(cli, "   Period %d us  Exec min/avg/max %d/%d/%d us  "
+                 "Missed %d of %d\n",
+                 tp.tp_period,
+                 tp.tp_activations ? tp.tp_exec_min : 0,
+                 tp.tp_activations ?
+                 (int)(tp.tp_exec_sum / tp.tp_activations) : 0,
+                 tp.tp_exec_max, tp.tp_missed, tp.tp_activations);
+    }
   }
   return 0;
 }
@@ -907,11 +2012,61 @@ cmd_ps(cli_t *cli, int argc, char **argv)
 CLI_CMD_DEF("ps", cmd_ps);
 
 
+#ifdef ENABLE_RPC
+
+#include <mios/rpc.h>
+
+/*
+ * thread_rtstat(name, which) returns a statistic for a periodic thread
+ * 0: Period, 1: Min exec, 2: Avg exec, 3: Max exec (all µs)
+ * 4: Activations, 5: Missed deadlines
+ */
+static error_t
+rpc_thread_rtstat(rpc_result_t *rr, const char *name, int which)
+{
+  thread_periodic_t tp;
+  int found = 0;
+  thread_t *t = NULL;
+  while((t = thread_get_next(t)) != NULL) {
+    if(found || strcmp(t->t_name, name))
+      continue;
+    int s = irq_forbid(IRQ_LEVEL_SCHED);
+    if(t->t_periodic != NULL) {
+      tp = *t->t_periodic;
+      found = 1;
+    }
+    irq_permit(s);
+  }
+  if(!found)
+    return ERR_NOT_FOUND;
+
+  const uint32_t avg = tp.tp_activations ?
+    tp.tp_exec_sum / tp.tp_activations : 0;
+
+  rr->type = RPC_TYPE_INT;
+  switch(which) {
+  case 0: rr->i32 = tp.tp_period; break;
+  case 1: rr->i32 = tp.tp_activations ? tp.tp_exec_min : 0; break;
+  case 2: rr->i32 = avg; break;
+  case 3: rr->i32 = tp.tp_exec_max; break;
+  case 4: rr->i32 = tp.tp_activations; break;
+  case 5: rr->i32 = tp.tp_missed; break;
+  default:
+    return ERR_INVALID_RPC_ARGS;
+  }
+  return 0;
+}
+
+RPC_DEF("thread_rtstat(si)", rpc_thread_rtstat);
+
+#endif
+
+
 error_t
 task_create_shell(void *(*entry)(void *arg), void *arg, const char *name,
                   size_t stack_size)
 {
-  int flags = TASK_DETACHED;
+  int flags = TASK_DETACHED | TASK_STACK_POOL;
 #ifdef HAVE_FPU
   flags |= TASK_FPU;
 #endif
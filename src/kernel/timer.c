@@ -1,5 +1,23 @@
 #include <mios/timer.h>
 
+#include <sys/param.h>
+
+#define SLOTS (1 << TIMER_WHEEL_BITS)
+#define SLOT_MASK (SLOTS - 1)
+#define SPAN_SHIFT (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)
+
+_Static_assert(SLOTS <= 32, "tl_pending is 32 bits");
+_Static_assert(TIMER_WHEEL_SHIFT + SPAN_SHIFT < 64, "Wheel too large");
+
+// A timer is stored in level 0 at the slot for its deadline if the
+// deadline agrees with tl_base on all bits above level 0, otherwise in
+// the lowest level where it agrees above that level. Thus all timers
+// at level N expire before any timer at level N + 1, and tl_base can
+// jump straight to the first non-empty slot.
+//
+// tl_cur and level 0 slots are kept sorted so dispatch can take timers
+// off the head. Higher levels are unsorted, they are only cascaded.
+
 static int
 timer_cmp(const timer_t *a, const timer_t *b)
 {
@@ -7,6 +25,114 @@ timer_cmp(const timer_t *a, const timer_t *b)
 }
 
 
+static void
+wheel_insert(struct timer_list *tl, timer_t *t)
+{
+  const uint64_t tick = t->t_expire >> TIMER_WHEEL_SHIFT;
+  if(tick <= tl->tl_base) {
+    LIST_INSERT_SORTED(&tl->tl_cur, t, t_link, timer_cmp);
+    return;
+  }
+
+  const int level = (63 - __builtin_clzll(tick ^ tl->tl_base)) /
+    TIMER_WHEEL_BITS;
+  if(level >= TIMER_WHEEL_LEVELS) {
+    LIST_INSERT_HEAD(&tl->tl_overflow, t, t_link);
+    return;
+  }
+
+  const int slot = (tick >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK;
+  struct timer_slot *ts = &tl->tl_slots[level][slot];
+  if(level == 0) {
+    LIST_INSERT_SORTED(ts, t, t_link, timer_cmp);
+  } else {
+    LIST_INSERT_HEAD(ts, t, t_link);
+  }
+  tl->tl_pending[level] |= 1u << slot;
+}
+
+
+// Return tick where first non-empty slot after tl_base starts or
+// UINT64_MAX if there are no such slots. If only the overflow list has
+// timers *levelp is set to TIMER_WHEEL_LEVELS and the start of the next
+// span is returned
+static uint64_t
+wheel_next_slot(struct timer_list *tl, int *levelp, int *slotp)
+{
+  for(int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    const int shift = level * TIMER_WHEEL_BITS;
+    const int cur = (tl->tl_base >> shift) & SLOT_MASK;
+    uint32_t m = tl->tl_pending[level] & ~((2u << cur) - 1);
+
+    while(m) {
+      const int slot = __builtin_ctz(m);
+      if(!LIST_EMPTY(&tl->tl_slots[level][slot])) {
+        *levelp = level;
+        *slotp = slot;
+        return ((tl->tl_base >> (shift + TIMER_WHEEL_BITS)) <<
+                (shift + TIMER_WHEEL_BITS)) | ((uint64_t)slot << shift);
+      }
+      // Timers were disarmed, clear lazily
+      tl->tl_pending[level] &= ~(1u << slot);
+      m &= m - 1;
+    }
+  }
+
+  if(LIST_EMPTY(&tl->tl_overflow))
+    return UINT64_MAX;
+  *levelp = TIMER_WHEEL_LEVELS;
+  return ((tl->tl_base >> SPAN_SHIFT) + 1) << SPAN_SHIFT;
+}
+
+
+// Move overflow timers that are now within the wheel's span
+static void
+wheel_pull_overflow(struct timer_list *tl)
+{
+  timer_t *t, *next;
+
+  for(t = LIST_FIRST(&tl->tl_overflow); t != NULL; t = next) {
+    next = LIST_NEXT(t, t_link);
+    if((t->t_expire >> (TIMER_WHEEL_SHIFT + SPAN_SHIFT)) <=
+       (tl->tl_base >> SPAN_SHIFT)) {
+      LIST_REMOVE(t, t_link);
+      wheel_insert(tl, t);
+    }
+  }
+}
+
+
+static void
+wheel_advance(struct timer_list *tl, uint64_t tick)
+{
+  int level, slot;
+
+  while(tl->tl_base < tick) {
+    const uint64_t next = wheel_next_slot(tl, &level, &slot);
+    if(next > tick || level == TIMER_WHEEL_LEVELS) {
+      // Nothing to cascade before tick. With only overflow timers left
+      // the wheel is empty so it's fine to skip spans
+      const uint64_t span = tl->tl_base >> SPAN_SHIFT;
+      tl->tl_base = tick;
+      if(tick >> SPAN_SHIFT != span)
+        wheel_pull_overflow(tl);
+      break;
+    }
+
+    tl->tl_base = next;
+
+    // Cascade into lower levels (or tl_cur)
+    struct timer_slot *ts = &tl->tl_slots[level][slot];
+    tl->tl_pending[level] &= ~(1u << slot);
+    timer_t *t;
+    while((t = LIST_FIRST(ts)) != NULL) {
+      LIST_REMOVE(t, t_link);
+      wheel_insert(tl, t);
+    }
+  }
+}
+
+
 void
 timer_arm_on_queue(timer_t *t, uint64_t expire, struct timer_list *tl)
 {
@@ -14,7 +140,7 @@ timer_arm_on_queue(timer_t *t, uint64_t expire, struct timer_list *tl)
     LIST_REMOVE(t, t_link);
 
   t->t_expire = expire;
-  LIST_INSERT_SORTED(tl, t, t_link, timer_cmp);
+  wheel_insert(tl, t);
 }
 
 
@@ -32,8 +158,10 @@ timer_disarm(timer_t *t)
 void
 timer_dispatch(struct timer_list *tl, uint64_t now)
 {
+  wheel_advance(tl, now >> TIMER_WHEEL_SHIFT);
+
   while(1) {
-    timer_t *t = LIST_FIRST(tl);
+    timer_t *t = LIST_FIRST(&tl->tl_cur);
     if(t == NULL)
       break;
     uint64_t expire = t->t_expire;
@@ -46,6 +174,25 @@ timer_dispatch(struct timer_list *tl, uint64_t now)
 }
 
 
+uint64_t
+timer_next(struct timer_list *tl)
+{
+  const timer_t *t = LIST_FIRST(&tl->tl_cur);
+  if(t != NULL)
+    return t->t_expire;
+
+  int level, slot;
+  const uint64_t next = wheel_next_slot(tl, &level, &slot);
+  if(next == UINT64_MAX)
+    return UINT64_MAX;
+
+  if(level == 0)
+    return LIST_FIRST(&tl->tl_slots[0][slot])->t_expire;
+  // Wake up at start of slot (or span) and cascade
+  return next << TIMER_WHEEL_SHIFT;
+}
+
+
 void
 timer_init(timer_t *t, void (*cb)(void *opaque, uint64_t expire),
            void *opaque, const char *name, uint64_t deadline)
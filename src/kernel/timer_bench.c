@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <mios/cli.h>
+#include <mios/prng.h>
+#include <mios/timer.h>
+
+/*
+ * Per-timer arm, disarm and dispatch cost on a private timer list.
+ * Deadlines are spread over twice the wheel span so every level and
+ * the overflow list get timers.
+ */
+
+#define TIMER_BENCH_SPAN \
+  (1ull << (TIMER_WHEEL_SHIFT + TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+#define TIMER_BENCH_STEPS 1000
+
+static void
+timer_bench_cb(void *opaque, uint64_t expire)
+{
+  (*(int *)opaque)++;
+}
+
+
+static void
+timer_bench_arm(timer_t *timers, int n, struct timer_list *tl, uint64_t now,
+                prng_t *prng)
+{
+  const uint64_t range = 2 * TIMER_BENCH_SPAN;
+  for(int j = 0; j < n; j++)
+    timer_arm_on_queue(&timers[j], now + 1 + prng_get(prng, j) % range, tl);
+}
+
+
+static error_t
+cmd_timer_bench(cli_t *cli, int argc, char **argv)
+{
+  static const int counts[] = {10, 100, 1000};
+  prng_t prng = {};
+
+  cli_printf(cli, "Timers  Arm(ns)  Disarm(ns)  Dispatch(ns)\n");
+
+  for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    const int n = counts[i];
+    struct timer_list *tl = xalloc(sizeof(struct timer_list), 0,
+                                   MEM_MAY_FAIL);
+    timer_t *timers = xalloc(n * sizeof(timer_t), 0, MEM_MAY_FAIL);
+    if(tl == NULL || timers == NULL) {
+      free(tl);
+      free(timers);
+      cli_printf(cli, "%6d  No memory\n", n);
+      continue;
+    }
+    memset(tl, 0, sizeof(struct timer_list));
+    memset(timers, 0, n * sizeof(timer_t));
+
+    int fired = 0;
+    for(int j = 0; j < n; j++) {
+      timers[j].t_cb = timer_bench_cb;
+      timers[j].t_opaque = &fired;
+    }
+
+    const uint64_t now = clock_get();
+    tl->tl_base = now >> TIMER_WHEEL_SHIFT;
+
+    uint64_t t0 = clock_get();
+    timer_bench_arm(timers, n, tl, now, &prng);
+    uint64_t t1 = clock_get();
+    for(int j = 0; j < n; j++)
+      timer_disarm(&timers[j]);
+    uint64_t t2 = clock_get();
+
+    timer_bench_arm(timers, n, tl, now, &prng);
+    uint64_t t3 = clock_get();
+    // Step through the whole range as a periodic tick would
+    const uint64_t step = 2 * TIMER_BENCH_SPAN / TIMER_BENCH_STEPS + 1;
+    for(int j = 1; j <= TIMER_BENCH_STEPS; j++)
+      timer_dispatch(tl, now + j * step);
+    uint64_t t4 = clock_get();
+
+    cli_printf(cli, "%6d  %7d  %10d  %12d%s\n", n,
+               (int)((t1 - t0) * 1000 / n),
+               (int)((t2 - t1) * 1000 / n),
+               (int)((t4 - t3) * 1000 / n),
+               fired == n ? "" : "  (Not all fired)");
+    free(timers);
+    free(tl);
+  }
+  return 0;
+}
+
+CLI_CMD_DEF("timerbench", cmd_timer_bench);
@@ -0,0 +1,285 @@
+#include <mios/trace.h>
+#include <mios/task.h>
+#include <mios/cli.h>
+#include <mios/stream.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "irq.h"
+#include "cpu.h"
+
+#ifdef ENABLE_NET_HTTP
+#include "net/http/http.h"
+#endif
+
+#define TRACE_DEFAULT_ENTRIES 512
+
+#define TRACE_IRQ_TID_BASE 16 // IRQs are shown on separate tracks
+
+#ifdef ENABLE_SMP
+#define TRACE_CPUS CPU_MAX
+#else
+#define TRACE_CPUS 1
+#endif
+
+typedef struct {
+  uint32_t ts;
+  uint8_t type;
+  uint8_t cpu;
+  int16_t arg;
+  const void *a;
+  const void *b;
+} trace_rec_t;
+
+uint8_t trace_enabled;
+
+static trace_rec_t *trace_buf;
+static uint32_t trace_mask;
+static uint32_t trace_head;
+static uint32_t trace_cycles_per_us;
+
+
+static inline uint32_t
+trace_timestamp(void)
+{
+#ifdef ENABLE_TASK_ACCOUNTING
+  return cpu_cycle_counter();
+#else
+  return clock_get_irq_blocked();
+#endif
+}
+
+
+void
+trace_record(uint8_t type, int16_t arg, const void *a, const void *b)
+{
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  if(trace_enabled) {
+    trace_rec_t *r = &trace_buf[trace_head++ & trace_mask];
+    r->ts = trace_timestamp();
+    r->type = type;
+#ifdef ENABLE_SMP
+    r->cpu = cpu_get_id();
+#else
+    r->cpu = 0;
+#endif
+    r->arg = arg;
+    r->a = a;
+    r->b = b;
+  }
+  irq_permit(q);
+}
+
+
+static void
+trace_set_enabled(int on)
+{
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  trace_enabled = on;
+  irq_permit(q);
+  irq_trace_enable(on);
+}
+
+
+static void
+trace_name(const void *p, char *buf, size_t len)
+{
+  if(thread_get_name(p, buf, len))
+    snprintf(buf, len, "%p", p);
+}
+
+
+static void
+trace_json_ts(stream_t *st, uint64_t cycles)
+{
+  const uint64_t ns = cycles * 1000 / trace_cycles_per_us;
+  stprintf(st, "\"ts\":%lld.%03d", (long long)(ns / 1000), (int)(ns % 1000));
+}
+
+
+static void
+trace_json_slice(stream_t *st, int cpu, const void *thread,
+                 uint64_t start, uint64_t end)
+{
+  char name[16];
+  trace_name(thread, name, sizeof(name));
+  const uint64_t ns = (end - start) * 1000 / trace_cycles_per_us;
+  stprintf(st, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,",
+           name, cpu);
+  trace_json_ts(st, start);
+  stprintf(st, ",\"dur\":%lld.%03d}", (long long)(ns / 1000), (int)(ns % 1000));
+}
+
+
+static void
+trace_export(stream_t *st)
+{
+  // Pause so we get a stable view of the ring
+  const int was_enabled = trace_enabled;
+  if(was_enabled)
+    trace_set_enabled(0);
+
+  stprintf(st, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  stprintf(st, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+           "\"args\":{\"name\":\"mios\"}}");
+
+  for(int i = 0; i < TRACE_CPUS; i++) {
+    stprintf(st, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+             "\"tid\":%d,\"args\":{\"name\":\"cpu%d\"}}", i, i);
+    stprintf(st, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+             "\"tid\":%d,\"args\":{\"name\":\"cpu%d irq\"}}",
+             TRACE_IRQ_TID_BASE + i, i);
+  }
+
+  struct {
+    const void *thread;
+    uint64_t start;
+    int irq_depth;
+  } cpus[TRACE_CPUS] = {};
+
+  const uint32_t size = trace_buf ? trace_mask + 1 : 0;
+  const uint32_t count = trace_head < size ? trace_head : size;
+  uint32_t prev = count ? trace_buf[(trace_head - count) & trace_mask].ts : 0;
+  uint64_t now = 0;
+  char name[16], name2[16];
+
+  for(uint32_t i = trace_head - count; i != trace_head; i++) {
+    const trace_rec_t *r = &trace_buf[i & trace_mask];
+    now += r->ts - prev;
+    prev = r->ts;
+
+    if(r->cpu >= TRACE_CPUS)
+      continue;
+
+    switch(r->type) {
+    case TRACE_SWITCH:
+      if(cpus[r->cpu].thread != NULL)
+        trace_json_slice(st, r->cpu, cpus[r->cpu].thread,
+                         cpus[r->cpu].start, now);
+      cpus[r->cpu].thread = r->b;
+      cpus[r->cpu].start = now;
+      break;
+
+    case TRACE_WAKEUP:
+      trace_name(r->a, name, sizeof(name));
+      trace_name(r->b, name2, sizeof(name2));
+      stprintf(st, ",\n{\"name\":\"wakeup %s\",\"ph\":\"i\",\"s\":\"t\","
+               "\"pid\":0,\"tid\":%d,\"args\":{\"by\":\"%s\"},",
+               name, r->cpu, name2);
+      trace_json_ts(st, now);
+      stprintf(st, "}");
+      break;
+
+    case TRACE_MUTEX_BLOCK:
+      trace_name(r->b, name, sizeof(name));
+      stprintf(st, ",\n{\"name\":\"mutex %p\",\"ph\":\"i\",\"s\":\"t\","
+               "\"pid\":0,\"tid\":%d,\"args\":{\"owner\":\"%s\"},",
+               r->a, r->cpu, name);
+      trace_json_ts(st, now);
+      stprintf(st, "}");
+      break;
+
+    case TRACE_IRQ_ENTER:
+    case TRACE_IRQ_EXIT:
+      if(r->type == TRACE_IRQ_ENTER) {
+        cpus[r->cpu].irq_depth++;
+      } else if(cpus[r->cpu].irq_depth) {
+        cpus[r->cpu].irq_depth--;
+      } else {
+        break; // Entry fell out of the ring
+      }
+      if(r->arg < 0)
+        stprintf(st, ",\n{\"name\":\"systick\",");
+      else
+        stprintf(st, ",\n{\"name\":\"irq %d\",", r->arg);
+      stprintf(st, "\"ph\":\"%c\",\"pid\":0,\"tid\":%d,",
+               r->type == TRACE_IRQ_ENTER ? 'B' : 'E',
+               TRACE_IRQ_TID_BASE + r->cpu);
+      trace_json_ts(st, now);
+      stprintf(st, "}");
+      break;
+    }
+  }
+
+  for(int i = 0; i < TRACE_CPUS; i++) {
+    if(cpus[i].thread != NULL)
+      trace_json_slice(st, i, cpus[i].thread, cpus[i].start, now);
+  }
+
+  stprintf(st, "\n]}\n");
+
+  if(was_enabled)
+    trace_set_enabled(1);
+}
+
+
+static error_t
+cmd_trace_start(cli_t *cli, int argc, char **argv)
+{
+  uint32_t entries = argc > 1 ? atoi(argv[1]) : TRACE_DEFAULT_ENTRIES;
+  if(entries < 2)
+    return ERR_INVALID_ARGS;
+  entries = 1 << (32 - __builtin_clz(entries - 1));
+
+  trace_set_enabled(0);
+
+  // Nothing can be writing to the ring now
+  free(trace_buf);
+  trace_buf = xalloc(entries * sizeof(trace_rec_t), 0, MEM_MAY_FAIL);
+  if(trace_buf == NULL)
+    return ERR_NO_MEMORY;
+  trace_mask = entries - 1;
+  trace_head = 0;
+
+#ifdef ENABLE_TASK_ACCOUNTING
+  const uint32_t c0 = cpu_cycle_counter();
+  udelay(1000);
+  trace_cycles_per_us = (cpu_cycle_counter() - c0) / 1000 ?: 1;
+#else
+  trace_cycles_per_us = 1;
+#endif
+
+  trace_set_enabled(1);
+  cli_printf(cli, "Tracing to %d entries\n", entries);
+  return 0;
+}
+
+CLI_CMD_DEF("trace-start", cmd_trace_start);
+
+
+static error_t
+cmd_trace_stop(cli_t *cli, int argc, char **argv)
+{
+  trace_set_enabled(0);
+  cli_printf(cli, "%d events recorded\n", trace_head);
+  return 0;
+}
+
+CLI_CMD_DEF("trace-stop", cmd_trace_stop);
+
+
+static error_t
+cmd_trace_dump(cli_t *cli, int argc, char **argv)
+{
+  trace_export(cli->cl_stream);
+  return 0;
+}
+
+CLI_CMD_DEF("trace-dump", cmd_trace_dump);
+
+
+#ifdef ENABLE_NET_HTTP
+static int
+trace_http(http_request_t *hr, int argc, const char **argv)
+{
+  stream_t *st = http_response_begin(hr, 200, "application/json");
+  trace_export(st);
+  st->close(st);
+  return 0;
+}
+
+HTTP_ROUTE_DEF("trace.json", trace_http);
+#endif
@@ -0,0 +1,248 @@
+#include <mios/workqueue.h>
+#include <mios/mios.h>
+#include <mios/cli.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "irq.h"
+
+#ifndef WORKQUEUE_STACK_SIZE
+#define WORKQUEUE_STACK_SIZE 1024
+#endif
+
+#define WORKQUEUE_SYSTEM_MAX_QUEUED 32
+
+struct workqueue {
+  STAILQ_HEAD(, work) wq_items;
+  task_waitable_t wq_wait;
+  SLIST_ENTRY(workqueue) wq_link;
+  const char *wq_name;
+  uint16_t wq_depth;
+  uint16_t wq_max_queued;
+  uint16_t wq_peak_depth;
+  uint8_t wq_workers;
+  uint8_t wq_prio;
+
+  // Statistics, latency is from submission until work starts (µs)
+  uint32_t wq_done;
+  uint32_t wq_rejected;
+  uint32_t wq_latency_max;
+  uint64_t wq_latency_sum;
+};
+
+static SLIST_HEAD(, workqueue) workqueues;
+static mutex_t workqueues_mutex = MUTEX_INITIALIZER("workqueues");
+
+
+static void *
+workqueue_worker(void *arg)
+{
+  workqueue_t *wq = arg;
+
+  int q = irq_forbid(IRQ_LEVEL_SCHED);
+  while(1) {
+    work_t *w = STAILQ_FIRST(&wq->wq_items);
+    if(w == NULL) {
+      task_sleep_sched_locked(&wq->wq_wait);
+      continue;
+    }
+    STAILQ_REMOVE_HEAD(&wq->wq_items, w_link);
+    wq->wq_depth--;
+    w->w_pending = 0;
+
+    const uint32_t latency = (uint32_t)clock_get_irq_blocked() - w->w_queued;
+    wq->wq_latency_sum += latency;
+    if(latency > wq->wq_latency_max)
+      wq->wq_latency_max = latency;
+    wq->wq_done++;
+    irq_permit(q);
+
+    w->w_fn(w);
+
+    q = irq_forbid(IRQ_LEVEL_SCHED);
+  }
+  return NULL;
+}
+
+
+workqueue_t *
+workqueue_create(const char *name, int workers, int prio,
+                 size_t stack_size, int flags, size_t max_queued)
+{
+  workqueue_t *wq = xalloc(sizeof(workqueue_t), 0, MEM_MAY_FAIL);
+  if(wq == NULL)
+    return NULL;
+  memset(wq, 0, sizeof(workqueue_t));
+
+  STAILQ_INIT(&wq->wq_items);
+  task_waitable_init(&wq->wq_wait, name);
+  wq->wq_name = name;
+  wq->wq_prio = prio;
+  wq->wq_max_queued = max_queued;
+
+  for(int i = 0; i < workers; i++) {
+    if(thread_create(workqueue_worker, wq, stack_size, name, flags, prio))
+      wq->wq_workers++;
+  }
+
+  if(wq->wq_workers == 0) {
+    free(wq);
+    return NULL;
+  }
+
+  mutex_lock(&workqueues_mutex);
+  SLIST_INSERT_HEAD(&workqueues, wq, wq_link);
+  mutex_unlock(&workqueues_mutex);
+  return wq;
+}
+
+
+workqueue_t *
+workqueue_get(int band)
+{
+  static workqueue_t *system_queues[3];
+  static const char *names[3] = {"wq-low", "wq-normal", "wq-high"};
+  static const uint8_t prios[3] = {1, 4, 8};
+  static mutex_t mutex = MUTEX_INITIALIZER("wqget");
+
+  if(band < 0 || band > 2)
+    return NULL;
+
+  workqueue_t *wq = __atomic_load_n(&system_queues[band], __ATOMIC_ACQUIRE);
+  if(wq != NULL)
+    return wq;
+
+  mutex_lock(&mutex);
+  wq = system_queues[band];
+  if(wq == NULL) {
+    wq = workqueue_create(names[band], 1, prios[band], WORKQUEUE_STACK_SIZE,
+#ifdef HAVE_FPU
+                          TASK_FPU |
+#endif
+                          0, WORKQUEUE_SYSTEM_MAX_QUEUED);
+    __atomic_store_n(&system_queues[band], wq, __ATOMIC_RELEASE);
+  }
+  mutex_unlock(&mutex);
+  return wq;
+}
+
+
+static error_t
+work_submit_sched_locked(workqueue_t *wq, work_t *w)
+{
+  if(w->w_pending)
+    return 0;
+
+  if(wq->wq_depth >= wq->wq_max_queued) {
+    wq->wq_rejected++;
+    return ERR_NO_BUFFER;
+  }
+
+  w->w_pending = 1;
+  w->w_queued = clock_get_irq_blocked();
+  STAILQ_INSERT_TAIL(&wq->wq_items, w, w_link);
+  wq->wq_depth++;
+  if(wq->wq_depth > wq->wq_peak_depth)
+    wq->wq_peak_depth = wq->wq_depth;
+  task_wakeup_sched_locked(&wq->wq_wait, 0);
+  return 0;
+}
+
+
+error_t
+work_submit(workqueue_t *wq, work_t *w)
+{
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  error_t err = work_submit_sched_locked(wq, w);
+  irq_permit(q);
+  return err;
+}
+
+
+int
+work_cancel(workqueue_t *wq, work_t *w)
+{
+  int r = 1;
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  if(w->w_pending) {
+    STAILQ_REMOVE(&wq->wq_items, w, work, w_link);
+    wq->wq_depth--;
+    w->w_pending = 0;
+    r = 0;
+  }
+  irq_permit(q);
+  return r;
+}
+
+
+static void
+delayed_work_timer_cb(void *opaque, uint64_t expire)
+{
+  delayed_work_t *dw = opaque;
+  work_submit(dw->dw_wq, &dw->dw_work);
+}
+
+
+void
+delayed_work_init(delayed_work_t *dw, void (*fn)(work_t *w))
+{
+  work_init(&dw->dw_work, fn);
+  memset(&dw->dw_timer, 0, sizeof(timer_t));
+  dw->dw_timer.t_cb = delayed_work_timer_cb;
+  dw->dw_timer.t_opaque = dw;
+  dw->dw_timer.t_name = "work";
+  dw->dw_wq = NULL;
+}
+
+
+void
+work_submit_delayed(workqueue_t *wq, delayed_work_t *dw, uint64_t deadline)
+{
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  dw->dw_wq = wq;
+  timer_arm_abs(&dw->dw_timer, deadline);
+  irq_permit(q);
+}
+
+
+int
+delayed_work_cancel(delayed_work_t *dw)
+{
+  const int q = irq_forbid(IRQ_LEVEL_SCHED);
+  int r = timer_disarm(&dw->dw_timer);
+  if(dw->dw_wq != NULL)
+    r &= work_cancel(dw->dw_wq, &dw->dw_work);
+  irq_permit(q);
+  return r;
+}
+
+
+static error_t
+cmd_wq(cli_t *cli, int argc, char **argv)
+{
+  workqueue_t *wq;
+
+  cli_printf(cli, "Name        Workers Prio Depth  Peak   Max      Done "
+             "Rejected  Avg lat  Max lat (us)\n");
+
+  mutex_lock(&workqueues_mutex);
+  SLIST_FOREACH(wq, &workqueues, wq_link) {
+    const int q = irq_forbid(IRQ_LEVEL_SCHED);
+    const workqueue_t s = *wq;
+    irq_permit(q);
+
+    cli_printf(cli, "%-11s %7d %4d %5d %5d %5d %9u %8u %8u %8u\n",
+               s.wq_name, s.wq_workers, s.wq_prio, s.wq_depth,
+               s.wq_peak_depth, s.wq_max_queued,
+               (unsigned int)s.wq_done, (unsigned int)s.wq_rejected,
+               (unsigned int)(s.wq_done ? s.wq_latency_sum / s.wq_done : 0),
+               (unsigned int)s.wq_latency_max);
+  }
+  mutex_unlock(&workqueues_mutex);
+  return 0;
+}
+
+CLI_CMD_DEF("wq", cmd_wq);
@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <mios/cli.h>
+#include <mios/prng.h>
+
+/*
+ * Random mix of small allocations and frees with an occasional larger
+ * one. Build with and without ENABLE_HEAP_TLSF to compare allocators.
+ */
+
+#define HEAP_BENCH_SLOTS 32
+
+static error_t
+cmd_heap_bench(cli_t *cli, int argc, char **argv)
+{
+  const int count = argc > 1 ? atoi(argv[1]) : 10000;
+  if(count < 1)
+    return ERR_INVALID_ARGS;
+
+  void *slots[HEAP_BENCH_SLOTS] = {};
+  prng_t prng = {};
+  int fails = 0;
+  heap_stats_t hs;
+
+  const int64_t start = clock_get();
+  for(int i = 0; i < count; i++) {
+    const uint32_t r = prng_get(&prng, i);
+    void **p = &slots[r % HEAP_BENCH_SLOTS];
+    if(*p != NULL) {
+      free(*p);
+      *p = NULL;
+    } else {
+      const size_t size = (r >> 8) & 0xf ? 8 + ((r >> 16) & 0x7f) : 1024;
+      *p = xalloc(size, 0, MEM_MAY_FAIL);
+      if(*p == NULL)
+        fails++;
+    }
+  }
+  const int64_t elapsed = clock_get() - start;
+
+  heap_get_stats(&hs, -1);
+  const int loaded = heap_fragmentation(&hs);
+
+  for(int i = 0; i < HEAP_BENCH_SLOTS; i++)
+    free(slots[i]);
+
+  heap_get_stats(&hs, -1);
+
+  cli_printf(cli, "%d ops, %d ns/op, %d failed\n", count,
+             (int)(elapsed * 1000 / count), fails);
+  cli_printf(cli, "Fragmentation: %d%% under load, %d%% after\n",
+             loaded, heap_fragmentation(&hs));
+  return 0;
+}
+
+CLI_CMD_DEF("heap-bench", cmd_heap_bench);
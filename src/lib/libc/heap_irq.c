@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <malloc.h>
+
+#include <mios/mios.h>
+
+#include "heap_irq.h"
+#include "irq.h"
+
+/*
+ * Heap access for IRQ handlers and t_run tasks
+ *
+ * Blocks freed with free_deferred() are pushed on a list that the heap
+ * drains on its next use from thread context. malloc_irq() pops a
+ * block from a reserve of MALLOC_IRQ_SIZE sized blocks, which the heap
+ * tops up the same way.
+ */
+
+#ifndef MALLOC_IRQ_RESERVE_MAX
+#define MALLOC_IRQ_RESERVE_MAX 8
+#endif
+
+void * volatile heap_irq_deferred;
+uint8_t heap_irq_reserve_count;
+uint8_t heap_irq_reserve_want;
+
+static void *heap_irq_reserve[MALLOC_IRQ_RESERVE_MAX];
+
+
+void
+free_deferred(void *ptr)
+{
+  if(ptr == NULL)
+    return;
+
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  *(void **)ptr = heap_irq_deferred;
+  heap_irq_deferred = ptr;
+  irq_permit(q);
+}
+
+
+void *
+heap_irq_take_deferred(void)
+{
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  void *list = heap_irq_deferred;
+  heap_irq_deferred = NULL;
+  irq_permit(q);
+  return list;
+}
+
+
+void *
+malloc_irq(size_t size)
+{
+  if(size > MALLOC_IRQ_SIZE)
+    return NULL;
+
+  void *x = NULL;
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  if(heap_irq_reserve_count)
+    x = heap_irq_reserve[--heap_irq_reserve_count];
+  irq_permit(q);
+  return x;
+}
+
+
+int
+heap_irq_reserve_put(void *ptr)
+{
+  int added = 0;
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  if(heap_irq_reserve_count < heap_irq_reserve_want) {
+    heap_irq_reserve[heap_irq_reserve_count++] = ptr;
+    added = 1;
+  }
+  irq_permit(q);
+  return added;
+}
+
+
+void
+malloc_irq_reserve(int count)
+{
+  int q = irq_forbid(IRQ_LEVEL_ALL);
+  count += heap_irq_reserve_want;
+  heap_irq_reserve_want = count < MALLOC_IRQ_RESERVE_MAX ?
+    count : MALLOC_IRQ_RESERVE_MAX;
+  irq_permit(q);
+}
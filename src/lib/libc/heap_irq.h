@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <mios/mios.h>
+
+/*
+ * Interface between the heap implementation and heap_irq.c
+ *
+ * When heap_irq_pending() the heap frees the deferred blocks and tops
+ * up the reserve. This is done from thread context with the heap
+ * locked, before allocating and freeing.
+ */
+
+extern void * volatile heap_irq_deferred;
+extern uint8_t heap_irq_reserve_count;
+extern uint8_t heap_irq_reserve_want;
+
+// Returns the list of deferred frees (linked via the first word)
+void *heap_irq_take_deferred(void);
+
+// Returns 1 if the block was added to the reserve
+int heap_irq_reserve_put(void *ptr);
+
+static inline int
+heap_irq_pending(void)
+{
+  return heap_irq_deferred != NULL ||
+    heap_irq_reserve_count < heap_irq_reserve_want;
+}
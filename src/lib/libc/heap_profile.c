@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <mios/cli.h>
+
+#include "heap_profile.h"
+
+/*
+ * Live heap usage aggregated per allocation site
+ *
+ * Sites beyond HEAP_PROFILE_SITES are summed up as "other". Peak is the
+ * highest number of bytes in use since boot or 'heap-profile reset'.
+ */
+
+#define HEAP_PROFILE_SITES 32
+
+typedef struct {
+  uintptr_t caller;
+  uint32_t oldest;
+  uint32_t type;
+  uint32_t count;
+  size_t bytes;
+} heap_site_t;
+
+typedef struct {
+  heap_site_t sites[HEAP_PROFILE_SITES + 1]; // Last is "other"
+  int num_sites;
+} heap_sites_t;
+
+size_t heap_profile_used;
+size_t heap_profile_peak;
+
+static struct {
+  size_t size;
+  size_t align;
+  size_t largest_free;
+  uintptr_t caller;
+  uint32_t time;
+  uint8_t type;
+} heap_profile_last_fail;
+
+
+void
+heap_profile_failed(size_t size, size_t align, int type, uintptr_t caller)
+{
+  heap_stats_t hs;
+  heap_get_stats(&hs, type & 0xf ?: -1);
+
+  heap_profile_last_fail.size = size;
+  heap_profile_last_fail.align = align;
+  heap_profile_last_fail.type = type & 0xf;
+  heap_profile_last_fail.caller = caller;
+  heap_profile_last_fail.largest_free = hs.largest_free;
+  heap_profile_last_fail.time = heap_profile_now();
+}
+
+
+static void
+heap_profile_add(void *opaque, int type, size_t size, uintptr_t caller,
+                 uint32_t time)
+{
+  heap_sites_t *hs = opaque;
+  heap_site_t *s = NULL;
+
+  for(int i = 0; i < hs->num_sites; i++) {
+    if(hs->sites[i].caller == caller && hs->sites[i].type == type) {
+      s = &hs->sites[i];
+      break;
+    }
+  }
+
+  if(s == NULL) {
+    if(hs->num_sites < HEAP_PROFILE_SITES) {
+      s = &hs->sites[hs->num_sites++];
+      s->caller = caller;
+      s->type = type;
+      s->oldest = time;
+    } else {
+      s = &hs->sites[HEAP_PROFILE_SITES];
+    }
+  }
+
+  s->count++;
+  s->bytes += size;
+  if(time < s->oldest)
+    s->oldest = time;
+}
+
+
+static void
+heap_profile_print_site(cli_t *cli, const heap_site_t *s, uint32_t now)
+{
+  cli_printf(cli, " 0x%08x %4x %6d %8d %8d\n",
+             (unsigned int)s->caller, s->type, s->count,
+             (int)s->bytes, (int)(now - s->oldest));
+}
+
+
+static error_t
+cmd_heap_profile(cli_t *cli, int argc, char **argv)
+{
+  if(argc > 1 && !strcmp(argv[1], "reset")) {
+    heap_profile_peak = heap_profile_used;
+    return 0;
+  }
+
+  // Too large for CLI thread stacks
+  heap_sites_t *hs = xalloc(sizeof(heap_sites_t), 0, MEM_MAY_FAIL);
+  if(hs == NULL)
+    return ERR_NO_MEMORY;
+  memset(hs, 0, sizeof(heap_sites_t));
+  heap_walk_used(heap_profile_add, hs);
+
+  // Largest first
+  for(int i = 1; i < hs->num_sites; i++) {
+    const heap_site_t x = hs->sites[i];
+    int j = i;
+    for(; j > 0 && x.bytes > hs->sites[j - 1].bytes; j--)
+      hs->sites[j] = hs->sites[j - 1];
+    hs->sites[j] = x;
+  }
+
+  const uint32_t now = heap_profile_now();
+  cli_printf(cli, " Site       Type  Count    Bytes  Oldest(s)\n");
+  for(int i = 0; i < hs->num_sites; i++)
+    heap_profile_print_site(cli, &hs->sites[i], now);
+  if(hs->sites[HEAP_PROFILE_SITES].count) {
+    cli_printf(cli, " (other)\n");
+    heap_profile_print_site(cli, &hs->sites[HEAP_PROFILE_SITES], now);
+  }
+  free(hs);
+
+  cli_printf(cli, "\n Type     Used     Free  Largest  Frag\n");
+  for(int type = 0; type < 16; type++) {
+    heap_stats_t st;
+    heap_get_stats(&st, type);
+    if(st.used + st.free == 0)
+      continue;
+    cli_printf(cli, " %4x %8d %8d %8d  %3d%%\n", type, (int)st.used,
+               (int)st.free, (int)st.largest_free, heap_fragmentation(&st));
+  }
+
+  cli_printf(cli, "\nIn use: %d bytes, peak: %d bytes\n",
+             (int)heap_profile_used, (int)heap_profile_peak);
+
+  if(heap_profile_last_fail.time || heap_profile_last_fail.caller) {
+    cli_printf(cli, "Last failed: %d bytes (align %d, type %x) from 0x%08x "
+               "%ds ago, largest free was %d\n",
+               (int)heap_profile_last_fail.size,
+               (int)heap_profile_last_fail.align,
+               heap_profile_last_fail.type,
+               (unsigned int)heap_profile_last_fail.caller,
+               (int)(now - heap_profile_last_fail.time),
+               (int)heap_profile_last_fail.largest_free);
+  }
+  return 0;
+}
+
+CLI_CMD_DEF("heap-profile", cmd_heap_profile);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * Interface between the heap implementation and heap_profile.c
+ * (ENABLE_HEAP_PROFILE). Every used block records the address its
+ * allocation was made from and when (in seconds since boot).
+ */
+
+#ifdef ENABLE_HEAP_PROFILE
+
+#define HEAP_CALLER ((uintptr_t)__builtin_return_address(0))
+
+extern size_t heap_profile_used;
+extern size_t heap_profile_peak;
+
+// Called with the heap locked
+static inline void
+heap_profile_alloc(size_t size)
+{
+  heap_profile_used += size;
+  if(heap_profile_used > heap_profile_peak)
+    heap_profile_peak = heap_profile_used;
+}
+
+static inline void
+heap_profile_free(size_t size)
+{
+  heap_profile_used -= size;
+}
+
+static inline uint32_t
+heap_profile_now(void)
+{
+  return clock_get() / 1000000;
+}
+
+void heap_profile_failed(size_t size, size_t align, int type,
+                         uintptr_t caller);
+
+typedef void (heap_walk_cb_t)(void *opaque, int type, size_t size,
+                              uintptr_t caller, uint32_t time);
+
+// Provided by the heap. Calls cb for every used block with the heap
+// locked so cb must not allocate
+void heap_walk_used(heap_walk_cb_t *cb, void *opaque);
+
+#else
+
+#define HEAP_CALLER 0
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <sys/queue.h>
 #include <stddef.h>
@@ -9,6 +10,10 @@
 #include <mios/mios.h>
 #include <mios/cli.h>
 #include <mios/task.h>
+#include <mios/slab.h>
+
+#include "heap_profile.h"
+#include "heap_irq.h"
 
 #define ALIGN(a, b) (((a) + (b) - 1) & ~((b) - 1))
 
@@ -23,7 +28,13 @@ typedef struct heap_block {
   struct heap_block *next;
   uint32_t prev : 31;
   uint32_t free : 1;
+#ifdef ENABLE_HEAP_PROFILE
+  uint32_t time;
+  uintptr_t caller;
+} __attribute__((aligned(16))) heap_block_t; // Must be a power of two
+#else
 } heap_block_t;
+#endif
 
 
 static struct heap_header_slist heaps;
@@ -141,6 +152,53 @@ heap_dump0(heap_block_t *hb)
 
 
 
+static void
+heap_stats_add(const heap_header_t *hh, heap_stats_t *hs)
+{
+  for(const heap_block_t *hb = hh->blocks; hb->next; hb = hb->next) {
+    const size_t size = hb_size(hb);
+    if(hb->free) {
+      hs->free += size;
+      if(size > hs->largest_free)
+        hs->largest_free = size;
+    } else {
+      hs->used += size;
+    }
+  }
+}
+
+
+void
+heap_get_stats(heap_stats_t *hs, int type)
+{
+  memset(hs, 0, sizeof(heap_stats_t));
+  mutex_lock(&heap_mutex);
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    if(type == -1 || type == hh->type)
+      heap_stats_add(hh, hs);
+  }
+  mutex_unlock(&heap_mutex);
+}
+
+
+#ifdef ENABLE_HEAP_PROFILE
+void
+heap_walk_used(heap_walk_cb_t *cb, void *opaque)
+{
+  mutex_lock(&heap_mutex);
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    for(const heap_block_t *hb = hh->blocks; hb->next; hb = hb->next) {
+      if(!hb->free)
+        cb(opaque, hh->type, hb_size(hb), hb->caller, hb->time);
+    }
+  }
+  mutex_unlock(&heap_mutex);
+}
+#endif
+
+
 static error_t
 cmd_mem(cli_t *cli, int argc, char **argv)
 {
@@ -150,22 +208,21 @@ cmd_mem(cli_t *cli, int argc, char **argv)
   SLIST_FOREACH(hh, &heaps, link) {
     cli_printf(cli, "Heap at %p type 0x%x\n", hh, hh->type);
     heap_block_t *hb = hh->blocks;
-    size_t use = 0;
-    size_t avail = 0;
     while(hb->next) {
       cli_printf(cli, "\t%s @ %p size:0x%08x %d\n",
                  hb->free ? "free" : "used",
                  hb, hb_size(hb), hb_size(hb));
-      if(hb->free)
-        avail += hb_size(hb);
-      else
-        use += hb_size(hb);
       hb = hb->next;
     }
-    cli_printf(cli, "\t%d bytes used, %d bytes free\n\n",
-               use, avail);
+    heap_stats_t hs = {};
+    heap_stats_add(hh, &hs);
+    cli_printf(cli, "\t%d bytes used, %d bytes free, "
+               "largest free %d, fragmentation %d%%\n\n",
+               hs.used, hs.free, hs.largest_free,
+               heap_fragmentation(&hs));
   }
   mutex_unlock(&heap_mutex);
+  slab_print_stats(cli->cl_stream);
   return 0;
 }
 
@@ -177,12 +234,13 @@ CLI_CMD_DEF("mem", cmd_mem);
 
 
 static void *
-heap_alloc(heap_block_t *hb, size_t size, size_t align)
+heap_alloc(heap_block_t *hb, size_t size, size_t align, uintptr_t caller)
 {
   if(align < sizeof(heap_block_t))
     align = sizeof(heap_block_t);
 
-  size = ALIGN(size, sizeof(heap_block_t));
+  // Room for the link used by free_deferred()
+  size = ALIGN(size ?: 1, sizeof(heap_block_t));
 
   for(; hb->next; hb = hb->next) {
     if(!hb->free)
@@ -232,6 +290,11 @@ heap_alloc(heap_block_t *hb, size_t size, size_t align)
       hb_set_prev(n, split);
     }
 
+#ifdef ENABLE_HEAP_PROFILE
+    hb->caller = caller;
+    hb->time = heap_profile_now();
+    heap_profile_alloc(hb_size(hb));
+#endif
     return (void *)aligned_addr;
   }
   return NULL;
@@ -259,6 +322,9 @@ heap_free(void *ptr)
   heap_block_t *hb = (heap_block_t *)ptr - 1;
   assert(!hb->free);
   hb->free = 1;
+#ifdef ENABLE_HEAP_PROFILE
+  heap_profile_free(hb_size(hb));
+#endif
 
   heap_merge_next(hb);
   heap_block_t *p = hb_get_prev(hb);
@@ -270,43 +336,78 @@ heap_free(void *ptr)
 
 
 static void *
-malloc0(size_t size, size_t align, int type)
+heap_alloc_any(size_t size, size_t align, int heap_type, uintptr_t caller)
 {
-  mutex_lock(&heap_mutex);
-
-  int heap_type = type & 0xf;
-
   heap_header_t *hh;
   SLIST_FOREACH(hh, &heaps, link) {
     heap_block_t *hb = hh->blocks;
     if(hb != NULL && (heap_type == 0 || heap_type == hh->type)) {
-      void *x = heap_alloc(hb, size, align);
-      if(x) {
-        mutex_unlock(&heap_mutex);
+      void *x = heap_alloc(hb, size, align, caller);
+      if(x)
         return x;
-      }
     }
   }
-  mutex_unlock(&heap_mutex);
-  if(!(type & MEM_MAY_FAIL))
-    panic("Out of memory (s=%d a=%d t=%d)", size, align, type & 0xf);
   return NULL;
 }
 
 
+// Called with heap_mutex held
+static void
+heap_irq_drain(void)
+{
+  void *p = heap_irq_take_deferred();
+  while(p != NULL) {
+    void *next = *(void **)p;
+    heap_free(p);
+    p = next;
+  }
+
+  while(heap_irq_reserve_count < heap_irq_reserve_want) {
+    void *x = heap_alloc_any(MALLOC_IRQ_SIZE, 0, 0, HEAP_CALLER);
+    if(x == NULL || !heap_irq_reserve_put(x)) {
+      heap_free(x);
+      break;
+    }
+  }
+}
+
+
+static void *
+malloc0(size_t size, size_t align, int type, uintptr_t caller)
+{
+  void *x;
+  do {
+    mutex_lock(&heap_mutex);
+    if(unlikely(heap_irq_pending()))
+      heap_irq_drain();
+    x = heap_alloc_any(size, align, type & 0xf, caller);
+    mutex_unlock(&heap_mutex);
+  } while(x == NULL && slab_reclaim());
+
+  if(x == NULL) {
+#ifdef ENABLE_HEAP_PROFILE
+    heap_profile_failed(size, align, type, caller);
+#endif
+    if(!(type & MEM_MAY_FAIL))
+      panic("Out of memory (s=%d a=%d t=%d)", size, align, type & 0xf);
+  }
+  return x;
+}
+
+
 
 
 void *
 malloc(size_t size)
 {
-  return malloc0(size, 0, 0);
+  return malloc0(size, 0, 0, HEAP_CALLER);
 }
 
 void *
 calloc(size_t nmemb, size_t size)
 {
   size *= nmemb;
-  void *x = malloc0(size, 0, 0);
+  void *x = malloc0(size, 0, 0, HEAP_CALLER);
   memset(x, 0, size);
   return x;
 }
@@ -315,6 +416,8 @@ void
 free(void *ptr)
 {
   mutex_lock(&heap_mutex);
+  if(unlikely(heap_irq_pending()))
+    heap_irq_drain();
   heap_free(ptr);
   mutex_unlock(&heap_mutex);
 }
@@ -331,16 +434,41 @@ free_try(void *ptr)
 }
 
 
+// No in-place resize, moves unless the current block is large enough
+void *
+realloc(void *ptr, size_t size)
+{
+  if(ptr == NULL)
+    return malloc(size);
+  if(size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  const heap_block_t *hb = (heap_block_t *)ptr - 1;
+  const size_t cur = hb_size(hb) - sizeof(heap_block_t);
+  if(size <= cur)
+    return ptr;
+
+  void *x = malloc0(size, 0, MEM_MAY_FAIL, HEAP_CALLER);
+  if(x != NULL) {
+    memcpy(x, ptr, cur);
+    free(ptr);
+  }
+  return x;
+}
+
+
 void *
 memalign(size_t size, size_t alignment)
 {
-  return malloc0(size, alignment, 0);
+  return malloc0(size, alignment, 0, HEAP_CALLER);
 }
 
 void *
 xalloc(size_t size, size_t alignment, unsigned int type)
 {
-  return malloc0(size, alignment, type);
+  return malloc0(size, alignment, type, HEAP_CALLER);
 }
 
 
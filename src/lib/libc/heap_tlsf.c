@@ -0,0 +1,595 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/queue.h>
+#include <stddef.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <mios/mios.h>
+#include <mios/cli.h>
+#include <mios/task.h>
+#include <mios/slab.h>
+
+#include "heap_profile.h"
+#include "heap_irq.h"
+
+/*
+ * Two-level segregated fit allocator
+ *
+ * Free blocks are kept on lists indexed by a first level (power of
+ * two) and a second level (TLSF_SL_COUNT linear steps within that
+ * power of two). Bitmaps over the lists make finding a block that is
+ * large enough, as well as freeing, O(1) regardless of fragmentation.
+ *
+ * Every block starts with a header pointing to the block physically
+ * before it. Free blocks keep their list links in the payload and
+ * free neighbours are always merged. Each heap ends with a zero sized
+ * sentinel block that is never free.
+ */
+
+#define ALIGN(a, b) (((a) + (b) - 1) & ~((b) - 1))
+
+#define TLSF_ALIGN    8
+#define TLSF_SL_LOG2  3
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 3) // + log2(TLSF_ALIGN)
+#define TLSF_SMALL    (1 << TLSF_FL_SHIFT) // Sizes below are mapped linearly
+#define TLSF_FL_MAX   32
+
+#define BLOCK_FREE 0x1
+
+typedef struct tlsf_block {
+  struct tlsf_block *prev_phys;
+  size_t size; // Payload size | BLOCK_FREE
+#ifdef ENABLE_HEAP_PROFILE
+  uintptr_t caller;
+  uint32_t time;
+#endif
+
+  // Payload starts here, only valid when free
+  struct tlsf_block *next_free;
+  struct tlsf_block *prev_free;
+} tlsf_block_t;
+
+#define BLOCK_OVERHEAD offsetof(tlsf_block_t, next_free)
+#define BLOCK_MIN_SIZE ALIGN(sizeof(tlsf_block_t) - BLOCK_OVERHEAD, TLSF_ALIGN)
+
+extern unsigned long _ebss;
+static const unsigned long ebss_start = (long)&_ebss;
+
+static mutex_t heap_mutex = MUTEX_INITIALIZER("heap");
+
+SLIST_HEAD(heap_header_slist, heap_header);
+
+static struct heap_header_slist heaps;
+
+typedef struct heap_header {
+  SLIST_ENTRY(heap_header) link;
+  tlsf_block_t *blocks;
+  void *end;
+  int type;
+  int fl_count;
+  uint32_t fl_bitmap;
+  uint8_t sl_bitmap[TLSF_FL_MAX];
+  tlsf_block_t *free[][TLSF_SL_COUNT]; // [fl_count]
+} heap_header_t;
+
+
+static inline size_t
+block_size(const tlsf_block_t *b)
+{
+  return b->size & ~BLOCK_FREE;
+}
+
+static inline int
+block_is_free(const tlsf_block_t *b)
+{
+  return b->size & BLOCK_FREE;
+}
+
+static inline void *
+block_payload(const tlsf_block_t *b)
+{
+  return (void *)b + BLOCK_OVERHEAD;
+}
+
+static inline tlsf_block_t *
+block_from_payload(void *ptr)
+{
+  return ptr - BLOCK_OVERHEAD;
+}
+
+static inline tlsf_block_t *
+block_next(const tlsf_block_t *b)
+{
+  return block_payload(b) + block_size(b);
+}
+
+
+static inline int
+tlsf_fls(size_t x)
+{
+  return sizeof(long) * 8 - 1 - __builtin_clzl(x);
+}
+
+
+static void
+mapping(size_t size, int *fl, int *sl)
+{
+  if(size < TLSF_SMALL) {
+    *fl = 0;
+    *sl = size / (TLSF_SMALL / TLSF_SL_COUNT);
+  } else {
+    const int f = tlsf_fls(size);
+    *sl = (size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+    *fl = f - TLSF_FL_SHIFT + 1;
+  }
+}
+
+
+// Round up so that every block on the list size maps to is large enough
+static size_t
+mapping_round(size_t size)
+{
+  if(size >= TLSF_SMALL)
+    size += (1 << (tlsf_fls(size) - TLSF_SL_LOG2)) - 1;
+  return size;
+}
+
+
+static void
+free_insert(heap_header_t *hh, tlsf_block_t *b)
+{
+  int fl, sl;
+  mapping(block_size(b), &fl, &sl);
+
+  tlsf_block_t *head = hh->free[fl][sl];
+  b->next_free = head;
+  b->prev_free = NULL;
+  if(head != NULL)
+    head->prev_free = b;
+  hh->free[fl][sl] = b;
+  hh->fl_bitmap |= 1 << fl;
+  hh->sl_bitmap[fl] |= 1 << sl;
+}
+
+
+static void
+free_remove(heap_header_t *hh, tlsf_block_t *b)
+{
+  if(b->next_free != NULL)
+    b->next_free->prev_free = b->prev_free;
+
+  if(b->prev_free != NULL) {
+    b->prev_free->next_free = b->next_free;
+    return;
+  }
+
+  int fl, sl;
+  mapping(block_size(b), &fl, &sl);
+  hh->free[fl][sl] = b->next_free;
+  if(b->next_free == NULL) {
+    hh->sl_bitmap[fl] &= ~(1 << sl);
+    if(!hh->sl_bitmap[fl])
+      hh->fl_bitmap &= ~(1 << fl);
+  }
+}
+
+
+// Remove and return a free block with at least size bytes of payload
+static tlsf_block_t *
+free_find(heap_header_t *hh, size_t size)
+{
+  int fl, sl;
+  mapping(mapping_round(size), &fl, &sl);
+  if(fl >= hh->fl_count)
+    return NULL;
+
+  uint32_t sl_map = hh->sl_bitmap[fl] & (~0U << sl);
+  if(!sl_map) {
+    const uint32_t fl_map = fl < 31 ? hh->fl_bitmap & (~0U << (fl + 1)) : 0;
+    if(!fl_map)
+      return NULL;
+    fl = __builtin_ctz(fl_map);
+    sl_map = hh->sl_bitmap[fl];
+  }
+  sl = __builtin_ctz(sl_map);
+
+  tlsf_block_t *b = hh->free[fl][sl];
+  free_remove(hh, b);
+  b->size &= ~BLOCK_FREE;
+  return b;
+}
+
+
+// Mark b free, merge with free neighbours and put it on a list
+static void
+block_release(heap_header_t *hh, tlsf_block_t *b)
+{
+  tlsf_block_t *next = block_next(b);
+  if(block_is_free(next)) {
+    free_remove(hh, next);
+    b->size = block_size(b) + BLOCK_OVERHEAD + block_size(next);
+    block_next(b)->prev_phys = b;
+  }
+
+  tlsf_block_t *prev = b->prev_phys;
+  if(prev != NULL && block_is_free(prev)) {
+    free_remove(hh, prev);
+    prev->size = block_size(prev) + BLOCK_OVERHEAD + block_size(b);
+    block_next(prev)->prev_phys = prev;
+    b = prev;
+  }
+
+  b->size |= BLOCK_FREE;
+  free_insert(hh, b);
+}
+
+
+// Shrink used block b to size, releasing the tail if large enough
+static void
+block_trim(heap_header_t *hh, tlsf_block_t *b, size_t size)
+{
+  const size_t bs = block_size(b);
+  if(bs < size + BLOCK_OVERHEAD + BLOCK_MIN_SIZE)
+    return;
+
+  tlsf_block_t *rest = block_payload(b) + size;
+  rest->prev_phys = b;
+  rest->size = bs - size - BLOCK_OVERHEAD;
+  b->size = size;
+  block_next(rest)->prev_phys = rest;
+  block_release(hh, rest);
+}
+
+
+static size_t
+heap_adjust_size(size_t size)
+{
+  return size < BLOCK_MIN_SIZE ? BLOCK_MIN_SIZE : ALIGN(size, TLSF_ALIGN);
+}
+
+
+void
+heap_add_mem(long start, long end, int type)
+{
+  if(start == HEAP_START_EBSS) {
+    start = ebss_start;
+  }
+  start = ALIGN(start, TLSF_ALIGN);
+  end &= ~(TLSF_ALIGN - 1);
+
+  // Only allocate first level lists for block sizes that can exist
+  int fl_count = tlsf_fls(end - start) - TLSF_FL_SHIFT + 2;
+  if(fl_count < 1)
+    fl_count = 1;
+  if(fl_count > TLSF_FL_MAX)
+    fl_count = TLSF_FL_MAX;
+
+  heap_header_t *hh = (void *)start;
+  const size_t hdr = ALIGN(sizeof(heap_header_t) +
+                           fl_count * sizeof(hh->free[0]), TLSF_ALIGN);
+  memset(hh, 0, hdr);
+  hh->fl_count = fl_count;
+  hh->type = type;
+  hh->end = (void *)end;
+
+  tlsf_block_t *b = (void *)start + hdr;
+  tlsf_block_t *sentinel = (void *)end - BLOCK_OVERHEAD;
+  b->prev_phys = NULL;
+  b->size = (void *)sentinel - block_payload(b);
+  sentinel->prev_phys = b;
+  sentinel->size = 0;
+  hh->blocks = b;
+
+  mutex_lock(&heap_mutex);
+  block_release(hh, b);
+  SLIST_INSERT_HEAD(&heaps, hh, link);
+  mutex_unlock(&heap_mutex);
+}
+
+
+static void *
+heap_alloc(heap_header_t *hh, size_t size, size_t align, uintptr_t caller)
+{
+  size = heap_adjust_size(size);
+
+  // Room to move the start forward and split off the gap
+  const size_t gap_max = align > TLSF_ALIGN ?
+    align + BLOCK_OVERHEAD + BLOCK_MIN_SIZE : 0;
+
+  tlsf_block_t *b = free_find(hh, size + gap_max);
+  if(b == NULL)
+    return NULL;
+
+  if(gap_max) {
+    void *p = block_payload(b);
+    void *aligned = (void *)ALIGN((uintptr_t)p, align);
+    if(aligned != p && aligned - p < BLOCK_OVERHEAD + BLOCK_MIN_SIZE)
+      aligned = (void *)ALIGN((uintptr_t)p + BLOCK_OVERHEAD + BLOCK_MIN_SIZE,
+                              align);
+    if(aligned != p) {
+      const size_t gap = aligned - p;
+      tlsf_block_t *nb = block_from_payload(aligned);
+      nb->prev_phys = b;
+      nb->size = block_size(b) - gap;
+      block_next(nb)->prev_phys = nb;
+      b->size = gap - BLOCK_OVERHEAD;
+      block_release(hh, b);
+      b = nb;
+    }
+  }
+
+  block_trim(hh, b, size);
+#ifdef ENABLE_HEAP_PROFILE
+  b->caller = caller;
+  b->time = heap_profile_now();
+  heap_profile_alloc(block_size(b));
+#endif
+  return block_payload(b);
+}
+
+
+static heap_header_t *
+heap_find(void *ptr)
+{
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    if(ptr > (void *)hh && ptr < hh->end)
+      return hh;
+  }
+  panic("Pointer %p not in any heap", ptr);
+}
+
+
+static void
+heap_free(void *ptr)
+{
+  if(ptr == NULL)
+    return;
+
+  tlsf_block_t *b = block_from_payload(ptr);
+  assert(!block_is_free(b));
+#ifdef ENABLE_HEAP_PROFILE
+  heap_profile_free(block_size(b));
+#endif
+  block_release(heap_find(ptr), b);
+}
+
+
+static void *
+heap_alloc_any(size_t size, size_t align, int heap_type, uintptr_t caller)
+{
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    if(heap_type == 0 || heap_type == hh->type) {
+      void *x = heap_alloc(hh, size, align, caller);
+      if(x)
+        return x;
+    }
+  }
+  return NULL;
+}
+
+
+// Called with heap_mutex held
+static void
+heap_irq_drain(void)
+{
+  void *p = heap_irq_take_deferred();
+  while(p != NULL) {
+    void *next = *(void **)p;
+    heap_free(p);
+    p = next;
+  }
+
+  while(heap_irq_reserve_count < heap_irq_reserve_want) {
+    void *x = heap_alloc_any(MALLOC_IRQ_SIZE, 0, 0, HEAP_CALLER);
+    if(x == NULL || !heap_irq_reserve_put(x)) {
+      heap_free(x);
+      break;
+    }
+  }
+}
+
+
+static void *
+malloc0(size_t size, size_t align, int type, uintptr_t caller)
+{
+  void *x;
+  do {
+    mutex_lock(&heap_mutex);
+    if(unlikely(heap_irq_pending()))
+      heap_irq_drain();
+    x = heap_alloc_any(size, align, type & 0xf, caller);
+    mutex_unlock(&heap_mutex);
+  } while(x == NULL && slab_reclaim());
+
+  if(x == NULL) {
+#ifdef ENABLE_HEAP_PROFILE
+    heap_profile_failed(size, align, type, caller);
+#endif
+    if(!(type & MEM_MAY_FAIL))
+      panic("Out of memory (s=%d a=%d t=%d)", size, align, type & 0xf);
+  }
+  return x;
+}
+
+
+void *
+malloc(size_t size)
+{
+  return malloc0(size, 0, 0, HEAP_CALLER);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  size *= nmemb;
+  void *x = malloc0(size, 0, 0, HEAP_CALLER);
+  memset(x, 0, size);
+  return x;
+}
+
+void
+free(void *ptr)
+{
+  mutex_lock(&heap_mutex);
+  if(unlikely(heap_irq_pending()))
+    heap_irq_drain();
+  heap_free(ptr);
+  mutex_unlock(&heap_mutex);
+}
+
+
+int
+free_try(void *ptr)
+{
+  if(mutex_trylock(&heap_mutex))
+    return 1;
+  heap_free(ptr);
+  mutex_unlock(&heap_mutex);
+  return 0;
+}
+
+
+// Grows in place if the following block is free and large enough,
+// otherwise moves to a new block from a heap of the same type
+void *
+realloc(void *ptr, size_t size)
+{
+  if(ptr == NULL)
+    return malloc(size);
+  if(size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  mutex_lock(&heap_mutex);
+  heap_header_t *hh = heap_find(ptr);
+  tlsf_block_t *b = block_from_payload(ptr);
+  const size_t want = heap_adjust_size(size);
+  const size_t cur = block_size(b);
+
+  if(want > cur) {
+    tlsf_block_t *next = block_next(b);
+    if(block_is_free(next) &&
+       cur + BLOCK_OVERHEAD + block_size(next) >= want) {
+      free_remove(hh, next);
+      b->size = cur + BLOCK_OVERHEAD + block_size(next);
+      block_next(b)->prev_phys = b;
+#ifdef ENABLE_HEAP_PROFILE
+      b->caller = HEAP_CALLER;
+#endif
+    } else {
+      void *x = heap_alloc_any(size, 0, hh->type, HEAP_CALLER);
+      if(x != NULL) {
+        memcpy(x, ptr, cur);
+        heap_free(ptr);
+      }
+      mutex_unlock(&heap_mutex);
+      return x;
+    }
+  }
+
+  block_trim(hh, b, want);
+#ifdef ENABLE_HEAP_PROFILE
+  heap_profile_free(cur);
+  heap_profile_alloc(block_size(b));
+#endif
+  mutex_unlock(&heap_mutex);
+  return ptr;
+}
+
+
+void *
+memalign(size_t size, size_t alignment)
+{
+  return malloc0(size, alignment, 0, HEAP_CALLER);
+}
+
+void *
+xalloc(size_t size, size_t alignment, unsigned int type)
+{
+  return malloc0(size, alignment, type, HEAP_CALLER);
+}
+
+
+static void
+heap_stats_add(const heap_header_t *hh, heap_stats_t *hs)
+{
+  for(const tlsf_block_t *b = hh->blocks; block_size(b);
+      b = block_next(b)) {
+    const size_t size = block_size(b);
+    if(block_is_free(b)) {
+      hs->free += size;
+      if(size > hs->largest_free)
+        hs->largest_free = size;
+    } else {
+      hs->used += size;
+    }
+  }
+}
+
+
+void
+heap_get_stats(heap_stats_t *hs, int type)
+{
+  memset(hs, 0, sizeof(heap_stats_t));
+  mutex_lock(&heap_mutex);
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    if(type == -1 || type == hh->type)
+      heap_stats_add(hh, hs);
+  }
+  mutex_unlock(&heap_mutex);
+}
+
+
+#ifdef ENABLE_HEAP_PROFILE
+void
+heap_walk_used(heap_walk_cb_t *cb, void *opaque)
+{
+  mutex_lock(&heap_mutex);
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    for(const tlsf_block_t *b = hh->blocks; block_size(b);
+        b = block_next(b)) {
+      if(!block_is_free(b))
+        cb(opaque, hh->type, block_size(b), b->caller, b->time);
+    }
+  }
+  mutex_unlock(&heap_mutex);
+}
+#endif
+
+
+static error_t
+cmd_mem(cli_t *cli, int argc, char **argv)
+{
+  mutex_lock(&heap_mutex);
+
+  heap_header_t *hh;
+  SLIST_FOREACH(hh, &heaps, link) {
+    cli_printf(cli, "Heap at %p type 0x%x\n", hh, hh->type);
+    for(const tlsf_block_t *b = hh->blocks; block_size(b);
+        b = block_next(b)) {
+      cli_printf(cli, "\t%s @ %p size:0x%08x %d\n",
+                 block_is_free(b) ? "free" : "used",
+                 b, block_size(b), block_size(b));
+    }
+    heap_stats_t hs = {};
+    heap_stats_add(hh, &hs);
+    cli_printf(cli, "\t%d bytes used, %d bytes free, "
+               "largest free %d, fragmentation %d%%\n\n",
+               hs.used, hs.free, hs.largest_free,
+               heap_fragmentation(&hs));
+  }
+  mutex_unlock(&heap_mutex);
+  slab_print_stats(cli->cl_stream);
+  return 0;
+}
+
+CLI_CMD_DEF("mem", cmd_mem);
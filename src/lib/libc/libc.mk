@@ -4,7 +4,16 @@ SRCS +=	\
 	${SRC}/lib/libc/string.c \
 	${SRC}/lib/libc/libc.c \
 	${SRC}/lib/libc/stdio.c \
-	${SRC}/lib/libc/heap_simple.c \
+	${SRC}/lib/libc/heap_irq.c \
+
+ifeq (${ENABLE_HEAP_TLSF},yes)
+SRCS += ${SRC}/lib/libc/heap_tlsf.c
+else
+SRCS += ${SRC}/lib/libc/heap_simple.c
+endif
+
+SRCS-${ENABLE_HEAP_PROFILE} += ${SRC}/lib/libc/heap_profile.c
+SRCS-${ENABLE_BENCH} += ${SRC}/lib/libc/heap_bench.c
 
 ${MOS}/lib/libc/%.o : CFLAGS += ${NOFPU}
 
@@ -12,11 +12,13 @@ void
 metric_reset(metric_t *m, int state)
 {
   int q = irq_forbid(m->def->irq_level);
+  seqlock_write_begin(&m->seq);
   if(state == METRIC_STATE_ON) {
     m->mean = 0;
     m->m2 = 0;
     m->count = 0;
   }
+  seqlock_write_end(&m->seq);
   m->state = state;
   m->alert_lockout = m->def->alert_lockout_duration;
   irq_permit(q);
@@ -26,6 +28,7 @@ void
 metric_init(metric_t *m, const metric_def_t *def, uint8_t state)
 {
   m->def = def;
+  m->seq = (seqlock_t)SEQLOCK_INITIALIZER;
   m->min = INFINITY;
   m->max = -INFINITY;
   m->state = state;
@@ -37,6 +40,7 @@ metric_collect(metric_t *m, float v)
 {
   if(m->state != METRIC_STATE_ON)
     return;
+  seqlock_write_begin(&m->seq);
   m->min = MIN(m->min, v);
   m->max = MAX(m->max, v);
 
@@ -45,6 +49,7 @@ metric_collect(metric_t *m, float v)
   m->mean += delta / m->count;
   float delta2 = v - m->mean;
   m->m2 += delta * delta2;
+  seqlock_write_end(&m->seq);
 }
 
 
@@ -104,13 +109,17 @@ cmd_metric(cli_t *cli, int argc, char **argv)
   SLIST_FOREACH(m, &metrics, link) {
     const metric_def_t *md = m->def;
 
-    int q = irq_forbid(md->irq_level);
-    float min = m->min;
-    float max = m->max;
-    float mean = m->mean;
-    float m2 = m->m2;
-    unsigned int count = m->count;
-    irq_permit(q);
+    float min, max, mean, m2;
+    unsigned int count;
+    uint32_t seq;
+    do {
+      seq = seqlock_read_begin(&m->seq);
+      min = m->min;
+      max = m->max;
+      mean = m->mean;
+      m2 = m->m2;
+      count = m->count;
+    } while(seqlock_read_retry(&m->seq, seq));
 
     float var = m2 / count;
     float stddev = sqrtf(var);
@@ -26,6 +26,7 @@
 #include <mios/bytestream.h>
 #include <mios/timer.h>
 #include <mios/atomic.h>
+#include <mios/slab.h>
 
 STAILQ_HEAD(http_connection_squeue, http_connection);
 STAILQ_HEAD(http_server_task_squeue, http_server_task);
@@ -33,6 +34,9 @@ TAILQ_HEAD(http_server_task_queue, http_server_task);
 
 static struct http_server_task_squeue http_task_queue;
 
+// STREAM_WRITE_STATIC writes smaller than this are copied anyway
+#define HTTP_EXT_MIN_SIZE 128
+
 static mutex_t http_mutex = MUTEX_INITIALIZER("http");
 static cond_t http_task_queue_cond = COND_INITIALIZER("rq");
 
@@ -86,6 +90,9 @@ struct http_connection {
   const char *hc_close_reason;
 };
 
+static slab_cache_t http_connection_cache =
+  SLAB_CACHE_INITIALIZER("http_connection", http_connection_t, NULL);
+
 #define OUTPUT_ENCODING_NONE      0
 #define OUTPUT_ENCODING_CHUNKED   1
 #define OUTPUT_ENCODING_WEBSOCKET 2
@@ -104,6 +111,14 @@ struct http_connection {
 
 
 
+static void
+http_server_task_free(http_server_task_t *hst)
+{
+  balloc_reset(hst->hst_ba);
+  free(hst);
+}
+
+
 static void
 http_timer_arm(http_connection_t *hc, int seconds)
 {
@@ -111,18 +126,24 @@ http_timer_arm(http_connection_t *hc, int seconds)
 }
 
 
+// Headers and body go in an arena that starts inside the request and
+// grows up to HTTP_REQUEST_ARENA_LIMIT
+#define HTTP_REQUEST_ALLOC_SIZE 1024
+#define HTTP_REQUEST_ARENA_LIMIT 16384
+
 static int
 http_server_message_begin(http_parser *p)
 {
-  const size_t alloc_size = 4096;
-
-  http_request_t *hr = xalloc(alloc_size, 0, MEM_MAY_FAIL);
+  http_request_t *hr = xalloc(HTTP_REQUEST_ALLOC_SIZE, 0, MEM_MAY_FAIL);
   if(hr == NULL) {
     return 0;
   }
 
   memset(hr, 0, sizeof(http_request_t));
-  hr->hr_bumpalloc.capacity = alloc_size - sizeof(http_request_t);
+  balloc_init(&hr->hr_bumpalloc,
+              HTTP_REQUEST_ALLOC_SIZE - sizeof(http_request_t),
+              HTTP_REQUEST_ARENA_LIMIT);
+  hr->hr_hst.hst_ba = &hr->hr_bumpalloc;
 
   http_connection_t *hc = p->data;
   hc->hc_task = &hr->hr_hst;
@@ -375,7 +396,8 @@ hsw_acquire(http_server_task_t **p, size_t capacity, uint8_t opcode)
   *p = &hsw->hsw_hst;
   memset(hsw, 0, sizeof(http_server_wsp_t));
   hsw->hsw_hst.hst_opcode = opcode;
-  hsw->hsw_bumpalloc.capacity = capacity;
+  balloc_init(&hsw->hsw_bumpalloc, capacity, 0);
+  hsw->hsw_hst.hst_ba = &hsw->hsw_bumpalloc;
   return hsw;
 }
 
@@ -604,7 +626,7 @@ http_connection_release(http_connection_t *hc)
   if(hc->hc_txbuf_head)
     pbuf_free(hc->hc_txbuf_head);
 
-  free(hc);
+  slab_free(&http_connection_cache, hc);
 }
 
 static void
@@ -625,12 +647,12 @@ http_close(void *opaque, const char *reason)
   http_connection_t *hc = opaque;
 
   if(hc->hc_task != NULL) {
-    free(hc->hc_task);
+    http_server_task_free(hc->hc_task);
     hc->hc_task = NULL;
   }
 
   if(hc->hc_ctrl_task != NULL) {
-    free(hc->hc_ctrl_task);
+    http_server_task_free(hc->hc_ctrl_task);
     hc->hc_ctrl_task = NULL;
   }
 
@@ -708,7 +730,7 @@ static http_connection_t *
 http_connection_create(enum http_parser_type type,
                        const http_parser_settings *parser_settings)
 {
-  http_connection_t *hc = xalloc(sizeof(http_connection_t), 0, MEM_MAY_FAIL);
+  http_connection_t *hc = slab_alloc(&http_connection_cache);
   if(hc == NULL)
     return NULL;
 
@@ -987,7 +1009,7 @@ http_thread(void *arg)
     http_connection_t *hc = hst->hst_hc;
     TAILQ_REMOVE(&hc->hc_tasks, hst, hst_connection_link);
     STAILQ_REMOVE_HEAD(&http_task_queue, hst_global_link);
-    free(hst);
+    http_server_task_free(hst);
     http_connection_release(hc);
   }
 }
@@ -1024,6 +1046,15 @@ add_chunked_encoding(http_connection_t *hc)
   hc->hc_txbuf_head = pb;
 
   pbuf_t *tail = hc->hc_txbuf_tail;
+  if(pbuf_data_shared(tail->pb_data)) {
+    // Tail references static data
+    pbuf_t *trailer = pbuf_make(0, 1);
+    trailer->pb_flags &= ~PBUF_SOP;
+    trailer->pb_pktlen = 0;
+    tail->pb_flags &= ~PBUF_EOP;
+    tail->pb_next = trailer;
+    tail = hc->hc_txbuf_tail = trailer;
+  }
   memcpy(tail->pb_data + tail->pb_offset + tail->pb_buflen, "\r\n", 2);
   tail->pb_buflen += 2;
   pb->pb_pktlen += 2;
@@ -1136,10 +1167,32 @@ http_stream_write(struct stream *s, const void *buf, size_t size, int flags)
 
       size_t remain =
         sk->max_fragment_size - hc->hc_txbuf_head->pb_pktlen - 10;
+
+      if(remain && (flags & STREAM_WRITE_STATIC) &&
+         size >= HTTP_EXT_MIN_SIZE &&
+         !(hc->hc_output_encoding == OUTPUT_ENCODING_WEBSOCKET &&
+           hc->hc_output_mask_bit)) {
+        // Reference the data instead of copying it
+        const size_t len = MIN(size, remain);
+        pbuf_t *pb = pbuf_make_ext(buf, len, NULL, NULL, 0);
+        if(pb != NULL) {
+          pb->pb_flags &= ~PBUF_SOP;
+          pb->pb_pktlen = 0;
+          hc->hc_txbuf_tail->pb_flags &= ~PBUF_EOP;
+          hc->hc_txbuf_tail->pb_next = pb;
+          hc->hc_txbuf_tail = pb;
+          hc->hc_txbuf_head->pb_pktlen += len;
+          buf += len;
+          size -= len;
+          continue;
+        }
+      }
+
       // Check if we need to allocate a new buffer for filling
       if(remain &&
-         hc->hc_txbuf_tail->pb_buflen +
-         hc->hc_txbuf_tail->pb_offset == PBUF_DATA_SIZE) {
+         (hc->hc_txbuf_tail->pb_buflen +
+          hc->hc_txbuf_tail->pb_offset == PBUF_DATA_SIZE ||
+          pbuf_data_shared(hc->hc_txbuf_tail->pb_data))) {
 
         pbuf_t *pb = pbuf_make(0, 0);
         if(pb == NULL) {
@@ -1389,7 +1442,7 @@ http_websocket_create(int (*cb)(void *opaque,
 
   socket_t *sk = tcp_create_socket(name);
   if(sk == NULL) {
-    free(hc);
+    slab_free(&http_connection_cache, hc);
     return NULL;
   }
 
@@ -24,6 +24,8 @@ typedef struct http_server_task {
 
   struct http_connection *hst_hc;
 
+  balloc_t *hst_ba; // Must be reset before the task is freed
+
   uint8_t hst_type;
   uint8_t hst_opcode;
 
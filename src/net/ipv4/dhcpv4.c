@@ -8,6 +8,7 @@
 #include <mios/cli.h>
 #include <mios/version.h>
 #include <mios/ghook.h>
+#include <mios/workqueue.h>
 
 #include <unistd.h>
 #include <stdio.h>
@@ -127,15 +128,15 @@ append_parameter_request_list(pbuf_t *pb)
 
 
 typedef struct {
+  work_t work;
   struct netif *ni;
   pbuf_t *vsi; // vendor specific info
 } dhcp_update_aux_t;
 
-__attribute__((noreturn))
-static void *
-dhcpv4_update_thread(void *arg)
+static void
+dhcpv4_update_work(work_t *w)
 {
-  dhcp_update_aux_t *dua = arg;
+  dhcp_update_aux_t *dua = (dhcp_update_aux_t *)w;
   pbuf_t *vsi = dua->vsi;
   const void *vsidata = vsi ? pbuf_data(vsi, 0) : NULL;
   size_t vsisize = vsi ? vsi->pb_buflen : 0;
@@ -143,7 +144,6 @@ dhcpv4_update_thread(void *arg)
   pbuf_free(vsi);
   device_release(&dua->ni->ni_dev);
   free(dua);
-  thread_exit(0);
 }
 
 static void
@@ -162,13 +162,9 @@ dhcpv4_update(netif_t *ni, pbuf_t **vsi)
   dua->ni = ni;
   device_retain(&ni->ni_dev);
 
-  thread_t *t = thread_create(dhcpv4_update_thread, dua,
-                              512, "dhcpupdate", TASK_DETACHED
-#ifdef HAVE_FPU
-                              | TASK_FPU
-#endif
-                              , 1);
-  if(t == NULL) {
+  work_init(&dua->work, dhcpv4_update_work);
+  workqueue_t *wq = workqueue_get(WORKQUEUE_LOW);
+  if(wq == NULL || work_submit(wq, &dua->work)) {
     pbuf_free(dua->vsi);
     device_release(&ni->ni_dev);
     free(dua);
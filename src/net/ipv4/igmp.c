@@ -131,7 +131,7 @@ igmp_group_join(uint32_t group)
 static void
 igmp_output(uint32_t group, uint32_t dst, uint8_t type)
 {
-  pbuf_t *pb = pbuf_make(IGMP_PBUF_HEADROOM, 1);
+  pbuf_t *pb = pbuf_make_size(IGMP_PBUF_HEADROOM, 0, 1);
   netif_t *ni = SLIST_FIRST(&netifs);
 
   pb = pbuf_prepend(pb, sizeof(igmp_packet_t), 1, 0);
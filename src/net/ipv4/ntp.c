@@ -91,7 +91,8 @@ ntp_input(struct netif *ni, pbuf_t *pb, size_t udp_offset)
 static void
 ntp_send(void)
 {
-  pbuf_t *pb = pbuf_make(16 + 20 + 8, 0); // Make space for ether + ip + udp
+  // Make space for ether + ip + udp
+  pbuf_t *pb = pbuf_make_size(16 + 20 + 8, sizeof(ntp_pkt_t), 0);
   if(pb == NULL)
     return;
   ntp_pkt_t *np = pbuf_append(pb, sizeof(ntp_pkt_t));
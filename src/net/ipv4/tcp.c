@@ -19,6 +19,7 @@
 #include <mios/service.h>
 #include <mios/eventlog.h>
 #include <mios/cli.h>
+#include <mios/slab.h>
 
 #define TCP_EVENT_CONNECT (1 << SOCKET_EVENT_PROTO)
 /*
@@ -114,6 +115,8 @@ typedef struct tcb {
 
 } tcb_t;
 
+static slab_cache_t tcb_cache = SLAB_CACHE_INITIALIZER("tcb", tcb_t, NULL);
+
 
 #define TCP_PBUF_HEADROOM (16 + sizeof(ipv4_header_t) + sizeof(tcp_hdr_t))
 
@@ -242,7 +245,9 @@ tcp_send(tcb_t *tcb, pbuf_t *pb, int seg_len, uint8_t flag)
       net_timer_arm(&tcb->tcb_rtx_timer, clock_get() + tcb->tcb_rto * 1000);
     }
 
-    pbuf_t *tx = pbuf_copy_pkt(pb, 0);
+    // SYN/FIN are rewritten in place by tcp_output_tcb()
+    pbuf_t *tx = pb->pb_flags & PBUF_SEQ ?
+      pbuf_copy_pkt(pb, 0) : pbuf_clone(pb, 0);
     while(pb) {
       pbuf_t *n = pb->pb_next;
       STAILQ_INSERT_TAIL(&tcb->tcb_unaq, pb, pb_link);
@@ -299,7 +304,7 @@ tcp_rtx_cb(void *opaque, uint64_t now)
     pb = NULL;
     if(tcb->tcb_state == TCP_STATE_ESTABLISHED) {
 
-      pb = pbuf_make(TCP_PBUF_HEADROOM, 0);
+      pb = pbuf_make_size(TCP_PBUF_HEADROOM, 0, 0);
       if(pb == NULL)
         return;
 
@@ -315,7 +320,7 @@ tcp_rtx_cb(void *opaque, uint64_t now)
   } else {
     // Retransmit data
 
-    pb = pbuf_copy_pkt(q, 0);
+    pb = q->pb_flags & PBUF_SEQ ? pbuf_copy_pkt(q, 0) : pbuf_clone(q, 0);
     if(pb != NULL) {
       pb = pbuf_prepend(pb, sizeof(tcp_hdr_t), 0, 0);
       if(pb != NULL) {
@@ -409,7 +414,7 @@ static void
 tcp_send_flag(tcb_t *tcb, uint8_t flag, pbuf_t *pb)
 {
   if(pb == NULL) {
-    pb = pbuf_make(TCP_PBUF_HEADROOM, 0);
+    pb = pbuf_make_size(TCP_PBUF_HEADROOM, 8, 0);
     if(pb == NULL) {
       return;
     }
@@ -452,7 +457,7 @@ tcp_destroy(tcb_t *tcb)
   if(!tcb->tcb_app_closed)
     return;
 
-  free(tcb);
+  slab_free(&tcb_cache, tcb);
 }
 
 
@@ -700,7 +705,7 @@ static const socket_net_fn_t tcp_net_fn = {
 static tcb_t *
 tcb_create(const char *name)
 {
-  tcb_t *tcb = xalloc(sizeof(tcb_t), 0, MEM_MAY_FAIL);
+  tcb_t *tcb = slab_alloc(&tcb_cache);
   if(tcb == NULL)
     return NULL;
 
@@ -839,7 +844,7 @@ tcp_input_ipv4(struct netif *ni, struct pbuf *pb, int tcp_offset)
 
     error_t err = svc->open(&tcb->tcb_sock);
     if(err) {
-      free(tcb);
+      slab_free(&tcb_cache, tcb);
       return tcp_reject(ni, pb, remote_addr, local_port_ho, seq + 1,
                         error_to_string(err));
     }
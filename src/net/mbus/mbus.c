@@ -76,7 +76,7 @@ mbus_output_unicast(pbuf_t *pb)
       return mni->mni_output(mni, pb);
     }
 
-    pbuf_t *copy = pbuf_copy(pb, 0);
+    pbuf_t *copy = pbuf_clone(pb, 0);
     if(copy != NULL) {
 
       mni->mni_tx_bytes += pb->pb_pktlen;
@@ -237,7 +237,7 @@ mbus_bcast(pbuf_t *pb, mbus_netif_t *src)
     if(mni == src)
       continue;
 
-    pbuf_t *copy = pbuf_copy(pb, 0);
+    pbuf_t *copy = pbuf_clone(pb, 0);
     if(copy == NULL)
       continue;
     mni->mni_tx_bytes += copy->pb_pktlen;
@@ -195,10 +195,9 @@ flow_find(mbus_svc_t *ms, uint32_t tag, int create)
   if(!create)
     return NULL;
 
-  mbus_seqpkt_con_t *msc = xalloc(sizeof(mbus_seqpkt_con_t), 0, MEM_MAY_FAIL);
+  mbus_seqpkt_con_t *msc = mbus_seqpkt_con_alloc();
   if(msc == NULL)
     return NULL;
-  memset(msc, 0, sizeof(mbus_seqpkt_con_t));
   msc->msc_name = "gdproxy";
   msc->msc_remote_xmit_credits = 1;
 
@@ -332,6 +331,10 @@ ms_output(struct mbus_netif *mni, pbuf_t *pb)
     const uint32_t tag = flow | (src_addr << 16) | (dst_addr << 24);
     mbus_seqpkt_con_t *msc = flow_find(ms, tag, 0);
     if(msc != NULL) {
+      // May be a clone of a packet sent on other interfaces as well
+      pb = pbuf_unshare(pb, 0);
+      if(pb == NULL)
+        return NULL;
       pb = pbuf_drop(pb, 3); // Drop header
       pbuf_trim(pb, 4); // Trim CRC
       return msc->msc_flow.mf_input(&msc->msc_flow, pb);
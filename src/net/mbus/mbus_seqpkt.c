@@ -9,6 +9,7 @@
 
 #include <mios/service.h>
 #include <mios/eventlog.h>
+#include <mios/slab.h>
 
 #include "net/pbuf.h"
 #include "mbus.h"
@@ -16,6 +17,9 @@
 #include "irq.h"
 #include "mbus_seqpkt_defs.h"
 
+static slab_cache_t mbus_seqpkt_con_cache =
+  SLAB_CACHE_INITIALIZER("seqpkt_con", mbus_seqpkt_con_t, NULL);
+
 static void mbus_seqpkt_rtx_timer(void *opaque, uint64_t expire);
 
 static void mbus_seqpkt_ack_timer(void *opaque, uint64_t expire);
@@ -161,6 +165,16 @@ mbus_seqpkt_accept_err(const char *name, const char *reason,
 }
 
 
+mbus_seqpkt_con_t *
+mbus_seqpkt_con_alloc(void)
+{
+  mbus_seqpkt_con_t *msc = slab_alloc(&mbus_seqpkt_con_cache);
+  if(msc != NULL)
+    memset(msc, 0, sizeof(mbus_seqpkt_con_t));
+  return msc;
+}
+
+
 void
 mbus_seqpkt_con_init(mbus_seqpkt_con_t *msc)
 {
@@ -212,12 +226,11 @@ mbus_seqpkt_accept(pbuf_t *pb, uint8_t remote_addr, uint16_t flow)
     return pb;
   }
 
-  mbus_seqpkt_con_t *msc = xalloc(sizeof(mbus_seqpkt_con_t), 0, MEM_MAY_FAIL);
+  mbus_seqpkt_con_t *msc = mbus_seqpkt_con_alloc();
   if(msc == NULL) {
     mbus_seqpkt_accept_err(name, "No memory", remote_addr);
     return pb;
   }
-  memset(msc, 0, sizeof(mbus_seqpkt_con_t));
 
   msc->msc_sock.max_fragment_size = MBUS_FRAGMENT_SIZE;
   msc->msc_sock.net = &mbus_seqpkt_fn;
@@ -225,7 +238,7 @@ mbus_seqpkt_accept(pbuf_t *pb, uint8_t remote_addr, uint16_t flow)
 
   error_t err = s->open(&msc->msc_sock);
   if(err) {
-    free(msc);
+    slab_free(&mbus_seqpkt_con_cache, msc);
     mbus_seqpkt_accept_err(name, error_to_string(err), remote_addr);
     return pb;
   }
@@ -441,7 +454,7 @@ mbus_seqpkt_maybe_destroy(mbus_seqpkt_con_t *msc)
   timer_disarm(&msc->msc_ka_timer);
   mbus_flow_remove(&msc->msc_flow);
   evlog(LOG_DEBUG, "seqpkt/%s: Destroyed", msc->msc_name);
-  free(msc);
+  slab_free(&mbus_seqpkt_con_cache, msc);
 }
 
 
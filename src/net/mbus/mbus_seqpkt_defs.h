@@ -97,3 +97,6 @@ typedef struct mbus_seqpkt_con {
 void mbus_seqpkt_txq_enq(mbus_seqpkt_con_t *msc, struct pbuf *pb);
 
 void mbus_seqpkt_con_init(mbus_seqpkt_con_t *msc);
+
+// Zeroed connection, freed by mbus_seqpkt_maybe_destroy()
+mbus_seqpkt_con_t *mbus_seqpkt_con_alloc(void);
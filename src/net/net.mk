@@ -2,6 +2,8 @@ GLOBALDEPS += ${SRC}/net/net.mk
 
 SRCS += ${SRC}/net/pbuf.c
 
+SRCS-${ENABLE_BENCH} += ${SRC}/net/pbuf_bench.c
+
 SRCS_net += \
 	${SRC}/net/service.c \
 	${SRC}/net/net_main.c \
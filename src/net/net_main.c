@@ -17,7 +17,7 @@
 
 struct netif_list netifs;
 
-static mutex_t netif_mutex = MUTEX_INITIALIZER("netifs");
+static rwlock_t netif_lock = RWLOCK_INITIALIZER("netifs");
 
 static task_waitable_t net_waitq = WAITABLE_INITIALIZER("net");
 
@@ -79,10 +79,10 @@ net_thread(void *arg)
       continue;
     }
 
-    const timer_t *t = LIST_FIRST(&net_timers);
-    if(t == NULL) {
+    const uint64_t next = timer_next(&net_timers);
+    if(next == UINT64_MAX) {
       task_sleep(&net_waitq);
-    } else if(task_sleep_deadline(&net_waitq, t->t_expire)) {
+    } else if(task_sleep_deadline(&net_waitq, next)) {
       uint64_t now = clock_get_irq_blocked();
       irq_permit(q);
       timer_dispatch(&net_timers, now);
@@ -97,12 +97,12 @@ netbuf_cb(net_task_t *nt, uint32_t signals)
 {
   netif_t *ni;
 
-  mutex_lock(&netif_mutex);
+  rwlock_rdlock(&netif_lock);
   SLIST_FOREACH(ni, &netifs, ni_global_link) {
     if(ni->ni_buffers_avail != NULL)
       ni->ni_buffers_avail(ni);
   }
-  mutex_unlock(&netif_mutex);
+  rwlock_rdunlock(&netif_lock);
 }
 
 
@@ -143,14 +143,14 @@ netif_attach(netif_t *ni, const char *name, const device_class_t *dc)
 
   ni->ni_task.nt_cb = netif_task_cb;
 
-  mutex_lock(&netif_mutex);
+  rwlock_wrlock(&netif_lock);
 
   SLIST_INSERT_HEAD(&netifs, ni, ni_global_link);
   if(ni->ni_buffers_avail)
     ni->ni_buffers_avail(ni);
   ni->ni_dev.d_class = dc;
   ni->ni_dev.d_name = name;
-  mutex_unlock(&netif_mutex);
+  rwlock_wrunlock(&netif_lock);
 
   device_register(&ni->ni_dev);
 }
@@ -174,9 +174,9 @@ netif_detach(netif_t *ni)
   pbuf_free_queue_irq_blocked(&ni->ni_rx_queue);
   irq_permit(q);
 
-  mutex_lock(&netif_mutex);
+  rwlock_wrlock(&netif_lock);
   SLIST_REMOVE(&netifs, ni, netif, ni_global_link);
-  mutex_unlock(&netif_mutex);
+  rwlock_wrunlock(&netif_lock);
 
   device_unregister(&ni->ni_dev);
 }
@@ -187,7 +187,7 @@ netif_get_net(netif_t *cur)
 {
   netif_t *ni;
 
-  mutex_lock(&netif_mutex);
+  rwlock_rdlock(&netif_lock);
   if(cur == NULL) {
     ni = SLIST_FIRST(&netifs);
   } else {
@@ -201,7 +201,7 @@ netif_get_net(netif_t *cur)
   }
   if(ni)
     device_retain(&ni->ni_dev);
-  mutex_unlock(&netif_mutex);
+  rwlock_rdunlock(&netif_lock);
   if(cur)
     device_release(&cur->ni_dev);
   return ni;
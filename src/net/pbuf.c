@@ -23,7 +23,77 @@ typedef struct pbuf_pool {
   int pp_avail;
 } pbuf_pool_t;
 
-static struct pbuf_pool pbuf_datas = { . pp_wait = WAITABLE_INITIALIZER("pbufdata")};
+/*
+ * Packet data comes in size classes. PBUF_DATA_SIZE is the default,
+ * used by pbuf_make() and drivers. Smaller and larger classes are used
+ * when a size is given (pbuf_make_size(), pbuf_data_get_size()). A
+ * class is only present if its size is on the right side of
+ * PBUF_DATA_SIZE. The class of a buffer is found from the address
+ * ranges it was added from.
+ *
+ * Buffers can be shared between pbufs (pbuf_clone()). Each region has a
+ * count of extra references per buffer, the buffer goes back to the
+ * pool when the last reference is put.
+ *
+ * Data outside all regions is external (pbuf_make_ext()) and always
+ * treated as shared. It has no capacity, pbuf_data_size() returns 0.
+ */
+
+#ifndef PBUF_SMALL_SIZE
+#define PBUF_SMALL_SIZE 128
+#endif
+
+#ifndef PBUF_LARGE_SIZE
+#define PBUF_LARGE_SIZE 1536
+#endif
+
+#ifndef PBUF_SMALL_COUNT
+#define PBUF_SMALL_COUNT 8
+#endif
+
+#ifndef PBUF_LARGE_COUNT
+#define PBUF_LARGE_COUNT 0
+#endif
+
+#define PBUF_CLASS_REGIONS 2
+
+typedef struct pbuf_class {
+  pbuf_pool_t pc_pool;
+  uint16_t pc_size;
+  uint16_t pc_total;
+  uint16_t pc_min_avail;
+  uint8_t pc_num_regions;
+  struct {
+    void *start;
+    void *end;
+    uint8_t *refs; // NULL if buffers in this region can't be shared
+  } pc_regions[PBUF_CLASS_REGIONS];
+} pbuf_class_t;
+
+#define PBUF_CLASS_INITIALIZER(size, name) {                    \
+    .pc_pool = { .pp_wait = WAITABLE_INITIALIZER(name) },       \
+    .pc_size = (size) }
+
+static pbuf_class_t pbuf_classes[] = {
+#if PBUF_SMALL_SIZE < PBUF_DATA_SIZE
+#define PBUF_HAVE_SMALL
+  PBUF_CLASS_INITIALIZER(PBUF_SMALL_SIZE, "pbufsmall"),
+#endif
+  PBUF_CLASS_INITIALIZER(PBUF_DATA_SIZE, "pbufdata"),
+#if PBUF_LARGE_SIZE > PBUF_DATA_SIZE
+#define PBUF_HAVE_LARGE
+  PBUF_CLASS_INITIALIZER(PBUF_LARGE_SIZE, "pbuflarge"),
+#endif
+};
+
+#define PBUF_NUM_CLASSES (sizeof(pbuf_classes) / sizeof(pbuf_classes[0]))
+
+#ifdef PBUF_HAVE_SMALL
+#define pbuf_datas pbuf_classes[1]
+#else
+#define pbuf_datas pbuf_classes[0]
+#endif
+
 static struct pbuf_pool pbufs  = { . pp_wait = WAITABLE_INITIALIZER("pbuf")};
 
 void __attribute__((weak))
@@ -92,32 +162,323 @@ pbuf_pool_add(pbuf_pool_t *pp, void *start, void *end, size_t item_size)
 #endif
 
 
+static pbuf_class_t *
+pbuf_class_find(const void *ptr, uint8_t **refp)
+{
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    pbuf_class_t *pc = &pbuf_classes[i];
+    for(size_t j = 0; j < pc->pc_num_regions; j++) {
+      if(ptr >= pc->pc_regions[j].start && ptr < pc->pc_regions[j].end) {
+        uint8_t *refs = pc->pc_regions[j].refs;
+        *refp = refs ? refs + (ptr - pc->pc_regions[j].start) / pc->pc_size
+          : NULL;
+        return pc;
+      }
+    }
+  }
+  *refp = NULL;
+  return NULL;
+}
+
+
+static size_t
+pbuf_class_add(pbuf_class_t *pc, void *start, void *end)
+{
+  if(pc->pc_num_regions == PBUF_CLASS_REGIONS) {
+    printf("pbuf: Too many regions for size %d\n", pc->pc_size);
+    return 0;
+  }
+
+  const size_t count = pbuf_pool_add(&pc->pc_pool, start, end, pc->pc_size);
+  uint8_t *refs = xalloc(count, 0, MEM_MAY_FAIL);
+  if(refs != NULL)
+    memset(refs, 0, count);
+
+  pc->pc_regions[pc->pc_num_regions].start = start;
+  pc->pc_regions[pc->pc_num_regions].end = end;
+  pc->pc_regions[pc->pc_num_regions].refs = refs;
+  pc->pc_num_regions++;
+
+  pc->pc_total += count;
+  pc->pc_min_avail = pc->pc_pool.pp_avail;
+  printf("pbuf: size:%d arena:%d count:%d\n",
+         pc->pc_size, end - start, count);
+  pbuf_alloc(count);
+  return count;
+}
+
+
+static void
+pbuf_class_alloc(size_t size, size_t count)
+{
+  if(count == 0)
+    return;
+  pbuf_class_t *pc = NULL;
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    if(pbuf_classes[i].pc_size == size)
+      pc = &pbuf_classes[i];
+  }
+  if(pc == NULL || pc->pc_num_regions)
+    return;
+
+  // Drivers DMA directly to/from packet buffers
+  void *start = xalloc(size * count, 0, MEM_TYPE_DMA | MEM_MAY_FAIL);
+  if(start != NULL)
+    pbuf_class_add(pc, start, start + size * count);
+}
+
+
 void
 pbuf_data_add(void *start, void *end)
 {
   if(end == NULL) {
-    if(pbuf_datas.pp_avail)
+    // Called from net_init(), heaps are set up by now
+#ifdef PBUF_HAVE_SMALL
+    pbuf_class_alloc(PBUF_SMALL_SIZE, PBUF_SMALL_COUNT);
+#endif
+#ifdef PBUF_HAVE_LARGE
+    pbuf_class_alloc(PBUF_LARGE_SIZE, PBUF_LARGE_COUNT);
+#endif
+    if(pbuf_datas.pc_pool.pp_avail)
       return;
     const size_t size = PBUF_DATA_SIZE * PBUF_DEFAULT_COUNT;
     start = xalloc(size, 0, 0);
     end = start + size;
   }
-  size_t count = pbuf_pool_add(&pbuf_datas, start, end, PBUF_DATA_SIZE);
-  printf("pbuf: size:%d arena:%d count:%d\n",
-         PBUF_DATA_SIZE, end - start, count);
-  pbuf_alloc(count);
+  pbuf_class_add(&pbuf_datas, start, end);
+}
+
+
+void
+pbuf_data_add_class(size_t size, void *start, void *end)
+{
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    if(pbuf_classes[i].pc_size == size) {
+      pbuf_class_add(&pbuf_classes[i], start, end);
+      return;
+    }
+  }
+  panic("pbuf: No class of size %d", size);
 }
 
+
+static void *
+pbuf_class_get(pbuf_class_t *pc, int wait)
+{
+  void *ptr = pbuf_pool_get(&pc->pc_pool, wait);
+  if(pc->pc_pool.pp_avail < pc->pc_min_avail)
+    pc->pc_min_avail = pc->pc_pool.pp_avail;
+  return ptr;
+}
+
+
 void *
 pbuf_data_get(int wait)
 {
-  return pbuf_pool_get(&pbuf_datas, wait);
+  return pbuf_class_get(&pbuf_datas, wait);
+}
+
+
+// Smallest class that fits and has buffers. If none has any, wait on
+// the smallest class that fits
+void *
+pbuf_data_get_size(size_t size, int wait)
+{
+  pbuf_class_t *fit = NULL;
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    pbuf_class_t *pc = &pbuf_classes[i];
+    if(pc->pc_size < size || pc->pc_total == 0)
+      continue;
+    void *ptr = pbuf_class_get(pc, 0);
+    if(ptr != NULL)
+      return ptr;
+    if(fit == NULL)
+      fit = pc;
+  }
+  if(fit == NULL || !wait)
+    return NULL;
+  return pbuf_class_get(fit, wait);
+}
+
+
+size_t
+pbuf_data_class_fit(size_t size)
+{
+  size_t largest = PBUF_DATA_SIZE;
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    const pbuf_class_t *pc = &pbuf_classes[i];
+    if(pc->pc_total == 0)
+      continue;
+    if(pc->pc_size >= size)
+      return pc->pc_size;
+    largest = pc->pc_size;
+  }
+  return largest;
+}
+
+
+/*
+ * External data with a release callback. Static data (no callback) is
+ * not tracked at all
+ */
+
+#ifndef PBUF_EXT_SLOTS
+#define PBUF_EXT_SLOTS 8
+#endif
+
+typedef struct pbuf_ext {
+  const void *pe_start;
+  const void *pe_end;
+  void (*pe_release)(void *opaque); // NULL if slot is free
+  void *pe_opaque;
+  uint16_t pe_refs; // Extra references, as for pool buffers
+} pbuf_ext_t;
+
+static pbuf_ext_t pbuf_exts[PBUF_EXT_SLOTS];
+
+
+static pbuf_ext_t *
+pbuf_ext_find(const void *ptr)
+{
+  for(size_t i = 0; i < PBUF_EXT_SLOTS; i++) {
+    pbuf_ext_t *pe = &pbuf_exts[i];
+    if(pe->pe_release != NULL && ptr >= pe->pe_start && ptr < pe->pe_end)
+      return pe;
+  }
+  return NULL;
+}
+
+
+static int
+pbuf_ext_add(const void *start, const void *end,
+             void (*release)(void *opaque), void *opaque)
+{
+  pbuf_ext_t *slot = NULL;
+  for(size_t i = 0; i < PBUF_EXT_SLOTS; i++) {
+    pbuf_ext_t *pe = &pbuf_exts[i];
+    if(pe->pe_release == NULL) {
+      if(slot == NULL)
+        slot = pe;
+      continue;
+    }
+    if(start >= pe->pe_end || end <= pe->pe_start)
+      continue;
+
+    // Overlapping data can only be told apart if it's the same
+    if(start != pe->pe_start || end != pe->pe_end ||
+       release != pe->pe_release || opaque != pe->pe_opaque ||
+       pe->pe_refs == UINT16_MAX)
+      return 0;
+    pe->pe_refs++;
+    return 1;
+  }
+
+  if(slot == NULL)
+    return 0;
+  slot->pe_start = start;
+  slot->pe_end = end;
+  slot->pe_release = release;
+  slot->pe_opaque = opaque;
+  slot->pe_refs = 0;
+  return 1;
+}
+
+
+size_t
+pbuf_data_size(const void *ptr)
+{
+  uint8_t *ref;
+  const pbuf_class_t *pc = pbuf_class_find(ptr, &ref);
+  return pc ? pc->pc_size : 0;
+}
+
+
+int
+pbuf_data_shared(const void *ptr)
+{
+  uint8_t *ref;
+  const pbuf_class_t *pc = pbuf_class_find(ptr, &ref);
+  return pc == NULL || (ref != NULL && *ref);
 }
 
+
 void
 pbuf_data_put(void *buf)
 {
-  pbuf_pool_put(&pbuf_datas, buf);
+  uint8_t *ref;
+  pbuf_class_t *pc = pbuf_class_find(buf, &ref);
+  if(pc == NULL) {
+    pbuf_ext_t *pe = pbuf_ext_find(buf);
+    if(pe == NULL)
+      return;
+    if(pe->pe_refs) {
+      pe->pe_refs--;
+      return;
+    }
+    void (*release)(void *opaque) = pe->pe_release;
+    pe->pe_release = NULL;
+    release(pe->pe_opaque);
+    return;
+  }
+  if(ref != NULL && *ref) {
+    (*ref)--;
+    return;
+  }
+  pbuf_pool_put(&pc->pc_pool, buf);
+}
+
+
+// Returns 0 if the buffer is at max references or can't be shared
+static int
+pbuf_data_ref(void *buf)
+{
+  uint8_t *ref;
+  const pbuf_class_t *pc = pbuf_class_find(buf, &ref);
+  if(pc == NULL) {
+    pbuf_ext_t *pe = pbuf_ext_find(buf);
+    if(pe == NULL)
+      return 1;
+    if(pe->pe_refs == UINT16_MAX)
+      return 0;
+    pe->pe_refs++;
+    return 1;
+  }
+  if(ref == NULL || *ref == UINT8_MAX)
+    return 0;
+  (*ref)++;
+  return 1;
+}
+
+
+// Private copy of a segment's data in a buffer of at least `min` bytes,
+// external data is copied to the start of a pool buffer
+static void *
+pbuf_data_dup(const pbuf_t *pb, size_t min, uint16_t *offsetp, int wait)
+{
+  const size_t size = pbuf_data_size(pb->pb_data);
+  const size_t offset = size ? pb->pb_offset : 0;
+  void *data = pbuf_data_get_size(MAX(size ?: pb->pb_buflen, min), wait);
+  if(data != NULL) {
+    memcpy(data + offset, pb->pb_data + pb->pb_offset, pb->pb_buflen);
+    *offsetp = offset;
+  }
+  return data;
+}
+
+
+// Give the segment a private copy of its data. Returns non-zero if out
+// of buffers
+static int
+pbuf_unshare_seg(pbuf_t *pb, size_t min, int wait)
+{
+  int q = irq_forbid(IRQ_LEVEL_NET);
+  void *data = pbuf_data_dup(pb, min, &pb->pb_offset, wait);
+  if(data != NULL) {
+    pbuf_data_put(pb->pb_data);
+    pb->pb_data = data;
+  }
+  irq_permit(q);
+  return data == NULL;
 }
 
 void
@@ -323,14 +684,28 @@ pbuf_trim(pbuf_t *pb, size_t bytes)
 pbuf_t *
 pbuf_prepend(pbuf_t *pb, size_t bytes, int wait, size_t extra_offset)
 {
-  if(bytes + extra_offset <= pb->pb_offset) {
+  const int shared = pbuf_data_shared(pb->pb_data);
+
+  if(!shared && bytes + extra_offset <= pb->pb_offset) {
     pb->pb_offset -= bytes;
     pb->pb_buflen += bytes;
     pb->pb_pktlen += bytes;
     return pb;
   }
 
-  pbuf_t *pre = pbuf_make(extra_offset, wait);
+  pbuf_t *pre;
+  if(shared) {
+    // Header goes at the end of a buffer of its own, with at least the
+    // headroom of the shared one so further headers can be prepended in
+    // place
+    const size_t headroom = pbuf_data_size(pb->pb_data) ?
+      MAX(pb->pb_offset, bytes + extra_offset) : bytes + extra_offset;
+    pre = pbuf_make_size(headroom, 0, wait);
+    if(pre != NULL)
+      pre->pb_offset = pbuf_data_size(pre->pb_data) - bytes;
+  } else {
+    pre = pbuf_make(extra_offset, wait);
+  }
   if(pre == NULL) {
     pbuf_free(pb);
     return NULL;
@@ -348,7 +723,8 @@ pbuf_prepend(pbuf_t *pb, size_t bytes, int wait, size_t extra_offset)
 void *
 pbuf_append(pbuf_t *pb, size_t bytes)
 {
-  assert(pb->pb_offset + pb->pb_buflen + bytes <= PBUF_DATA_SIZE);
+  assert(pb->pb_offset + pb->pb_buflen + bytes <= pbuf_data_size(pb->pb_data));
+  assert(!pbuf_data_shared(pb->pb_data));
   void *r = pb->pb_data + pb->pb_offset + pb->pb_buflen;
   pb->pb_buflen += bytes;
   pb->pb_pktlen += bytes;
@@ -369,8 +745,16 @@ pbuf_pullup(pbuf_t *pb, size_t bytes)
   if(pb->pb_buflen >= bytes)
     return 0;
 
-  if(bytes + pb->pb_offset > PBUF_DATA_SIZE) {
-    assert(bytes <= PBUF_DATA_SIZE);
+  // Shared data needs a private copy, and a small or external buffer
+  // may not be able to hold the pulled up bytes at all
+  if((pbuf_data_shared(pb->pb_data) ||
+      pbuf_data_size(pb->pb_data) < bytes) &&
+     pbuf_unshare_seg(pb, bytes, 0))
+    return bytes - pb->pb_buflen;
+
+  const size_t capacity = pbuf_data_size(pb->pb_data);
+  if(bytes + pb->pb_offset > capacity) {
+    assert(bytes <= capacity);
     memcpy(pb->pb_data, pb->pb_data + pb->pb_offset, pb->pb_buflen);
     pb->pb_offset = 0;
   }
@@ -483,13 +867,13 @@ pbuf_reset(pbuf_t *pb, size_t header_size, size_t len)
   pb->pb_pktlen = len;
 }
 
-pbuf_t *
-pbuf_make_irq_blocked(int offset, int wait)
+static pbuf_t *
+pbuf_make_data(int offset, size_t size, int wait)
 {
   pbuf_t *pb = pbuf_get(wait);
   if(pb != NULL) {
     pb->pb_next = NULL;
-    pb->pb_data = pbuf_data_get(wait);
+    pb->pb_data = size ? pbuf_data_get_size(size, wait) : pbuf_data_get(wait);
     if(pb->pb_data == NULL) {
       pbuf_put(pb);
     } else {
@@ -505,6 +889,23 @@ pbuf_make_irq_blocked(int offset, int wait)
 }
 
 
+pbuf_t *
+pbuf_make_irq_blocked(int offset, int wait)
+{
+  return pbuf_make_data(offset, 0, wait);
+}
+
+
+pbuf_t *
+pbuf_make_size(int offset, size_t size, int wait)
+{
+  int q = irq_forbid(IRQ_LEVEL_NET);
+  pbuf_t *pb = pbuf_make_data(offset, offset + size, wait);
+  irq_permit(q);
+  return pb;
+}
+
+
 pbuf_t *
 pbuf_make(int offset, int wait)
 {
@@ -515,6 +916,34 @@ pbuf_make(int offset, int wait)
 }
 
 
+pbuf_t *
+pbuf_make_ext(const void *data, size_t len,
+              void (*release)(void *opaque), void *opaque, int wait)
+{
+  assert(len > 0 && len <= UINT16_MAX);
+  assert(pbuf_data_size(data) == 0);
+
+  int q = irq_forbid(IRQ_LEVEL_NET);
+  pbuf_t *pb = pbuf_get(wait);
+  if(pb != NULL) {
+    if(release != NULL && !pbuf_ext_add(data, data + len, release, opaque)) {
+      pbuf_put(pb);
+      pb = NULL;
+    } else {
+      pb->pb_next = NULL;
+      pb->pb_data = (void *)data;
+      pb->pb_flags = PBUF_SOP | PBUF_EOP;
+      pb->pb_credits = 0;
+      pb->pb_pktlen = len;
+      pb->pb_offset = 0;
+      pb->pb_buflen = len;
+    }
+  }
+  irq_permit(q);
+  return pb;
+}
+
+
 pbuf_t *
 pbuf_copy(const pbuf_t *src, int wait)
 {
@@ -522,17 +951,14 @@ pbuf_copy(const pbuf_t *src, int wait)
   pbuf_t *dst = pbuf_get(wait);
   if(dst != NULL) {
     dst->pb_next = NULL;
-    dst->pb_data = pbuf_data_get(wait);
+    dst->pb_data = pbuf_data_dup(src, 0, &dst->pb_offset, wait);
     if(dst->pb_data == NULL) {
       pbuf_put(dst);
     } else {
       irq_permit(q);
       dst->pb_flags = src->pb_flags;
       dst->pb_pktlen = src->pb_pktlen;
-      dst->pb_offset = src->pb_offset;
       dst->pb_buflen = src->pb_buflen;
-      memcpy(dst->pb_data + dst->pb_offset, src->pb_data + dst->pb_offset,
-             src->pb_buflen);
       return dst;
     }
   }
@@ -541,8 +967,8 @@ pbuf_copy(const pbuf_t *src, int wait)
 }
 
 
-pbuf_t *
-pbuf_copy_pkt(const pbuf_t *src, int wait)
+static pbuf_t *
+pbuf_dup_pkt(const pbuf_t *src, int wait, int share)
 {
   pbuf_t *r = NULL;
   pbuf_t **dp = &r;
@@ -558,20 +984,22 @@ pbuf_copy_pkt(const pbuf_t *src, int wait)
     }
 
     dst->pb_next = NULL;
-    dst->pb_data = pbuf_data_get(wait);
-    if(dst->pb_data == NULL) {
-      pbuf_put(dst);
-      pbuf_free_irq_blocked(r);
-      r = NULL;
-      break;
+    if(share && pbuf_data_ref(src->pb_data)) {
+      dst->pb_data = src->pb_data;
+      dst->pb_offset = src->pb_offset;
+    } else {
+      dst->pb_data = pbuf_data_dup(src, 0, &dst->pb_offset, wait);
+      if(dst->pb_data == NULL) {
+        pbuf_put(dst);
+        pbuf_free_irq_blocked(r);
+        r = NULL;
+        break;
+      }
     }
 
     dst->pb_flags = src->pb_flags;
     dst->pb_pktlen = src->pb_pktlen;
-    dst->pb_offset = src->pb_offset;
     dst->pb_buflen = src->pb_buflen;
-    memcpy(dst->pb_data + dst->pb_offset, src->pb_data + dst->pb_offset,
-           src->pb_buflen);
 
     *dp = dst;
     dp = &dst->pb_next;
@@ -584,11 +1012,58 @@ pbuf_copy_pkt(const pbuf_t *src, int wait)
 }
 
 
+
+pbuf_t *
+pbuf_copy_pkt(const pbuf_t *src, int wait)
+{
+  return pbuf_dup_pkt(src, wait, 0);
+}
+
+
+pbuf_t *
+pbuf_clone(const pbuf_t *src, int wait)
+{
+  return pbuf_dup_pkt(src, wait, 1);
+}
+
+
+pbuf_t *
+pbuf_unshare(pbuf_t *pb, int wait)
+{
+  for(pbuf_t *seg = pb; seg != NULL; seg = seg->pb_next) {
+    if(pbuf_data_shared(seg->pb_data) && pbuf_unshare_seg(seg, 0, wait)) {
+      pbuf_free(pb);
+      return NULL;
+    }
+    if(seg->pb_flags & PBUF_EOP)
+      break;
+  }
+  return pb;
+}
+
 void
 pbuf_status(stream_t *st)
 {
   stprintf(st, "pbuf: %d avail\n", pbufs.pp_avail);
-  stprintf(st, "pbuf_data: %d avail\n", pbuf_datas.pp_avail);
+  stprintf(st, "pbuf_data:  Size Total Avail   Min Shared\n");
+  for(size_t i = 0; i < PBUF_NUM_CLASSES; i++) {
+    const pbuf_class_t *pc = &pbuf_classes[i];
+    int shared = 0;
+    for(size_t j = 0; j < pc->pc_num_regions; j++) {
+      const uint8_t *refs = pc->pc_regions[j].refs;
+      const size_t count = (pc->pc_regions[j].end -
+                            pc->pc_regions[j].start) / pc->pc_size;
+      for(size_t k = 0; refs != NULL && k < count; k++)
+        shared += !!refs[k];
+    }
+    stprintf(st, "           %5d %5d %5d %5d %6d\n", pc->pc_size,
+             pc->pc_total, pc->pc_pool.pp_avail, pc->pc_min_avail, shared);
+  }
+
+  int ext = 0;
+  for(size_t i = 0; i < PBUF_EXT_SLOTS; i++)
+    ext += pbuf_exts[i].pe_release != NULL;
+  stprintf(st, "pbuf_ext: %d/%d in use\n", ext, PBUF_EXT_SLOTS);
 }
 
 
@@ -60,12 +60,41 @@ void pbuf_free(pbuf_t *pb);
 __attribute__((warn_unused_result))
 pbuf_t *pbuf_make(int offset, int wait);
 
+// Like pbuf_make() but from the smallest size class with room for
+// offset + size bytes
+__attribute__((warn_unused_result))
+pbuf_t *pbuf_make_size(int offset, size_t size, int wait);
+
 __attribute__((warn_unused_result))
 pbuf_t *pbuf_copy(const pbuf_t *src, int wait);
 
 __attribute__((warn_unused_result))
 pbuf_t *pbuf_copy_pkt(const pbuf_t *src, int wait);
 
+// Like pbuf_copy_pkt() but the data is shared with src, only the pbuf
+// headers are new. Shared data must not be written to. pbuf_prepend()
+// puts headers in a new buffer, pbuf_pullup() copies as needed. Other
+// writers must call pbuf_unshare() first
+__attribute__((warn_unused_result))
+pbuf_t *pbuf_clone(const pbuf_t *src, int wait);
+
+// Make sure no data in the packet is shared. Frees the packet and
+// returns NULL if out of buffers
+__attribute__((warn_unused_result))
+pbuf_t *pbuf_unshare(pbuf_t *pb, int wait);
+
+// Packet referencing len bytes of memory outside the pbuf pools. The
+// data is never written to and is read by network DMA, so it must be
+// DMA reachable. release(opaque) is called when the last pbuf
+// referencing the data is freed, possibly from IRQ context. Without
+// release the data must stay valid forever (const data in flash, etc).
+// Returns NULL if out of pbufs, or if release is set and the data
+// overlaps other external data with a different release/opaque
+__attribute__((warn_unused_result))
+pbuf_t *pbuf_make_ext(const void *data, size_t len,
+                      void (*release)(void *opaque), void *opaque,
+                      int wait);
+
 __attribute__((warn_unused_result))
 void *pbuf_append(pbuf_t *pb, size_t bytes);
 
@@ -104,9 +133,26 @@ void pbuf_dump_stream(const char *prefix, const pbuf_t *pb, int full,
 
 void pbuf_data_add(void *start, void *end);
 
+// Add buffers to the size class of 'size' (PBUF_SMALL_SIZE, etc)
+void pbuf_data_add_class(size_t size, void *start, void *end);
+
 __attribute__((warn_unused_result, malloc))
 void *pbuf_data_get(int wait);
 
+// Buffer from the smallest class that holds at least 'size' bytes
+__attribute__((warn_unused_result, malloc))
+void *pbuf_data_get_size(size_t size, int wait);
+
+// Capacity of a buffer returned by pbuf_data_get*()
+size_t pbuf_data_size(const void *ptr);
+
+// Non-zero if the buffer is referenced by more than one pbuf
+int pbuf_data_shared(const void *ptr);
+
+// Capacity of the class pbuf_data_get_size() would pick, or of the
+// largest class if none is big enough
+size_t pbuf_data_class_fit(size_t size);
+
 void pbuf_data_put(void *ptr);
 
 void pbuf_alloc(size_t count);
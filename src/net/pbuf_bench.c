@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <mios/cli.h>
+#include <mios/prng.h>
+
+#include "pbuf.h"
+
+/*
+ * Allocates a random mix of packet sizes from the live pools, first
+ * with PBUF_DATA_SIZE buffers only and then from the size classes, and
+ * reports the buffer memory and heap actually used while the packets
+ * are held. Packets larger than a buffer are chained. Allocation never
+ * waits and leaves the pools' reserve alone, so the network keeps
+ * running, but a busy system may see failed packets.
+ */
+
+static const uint16_t pbuf_bench_sizes[] = {
+  40, 40, 40, 64, 64, 300, 1500, 1500
+};
+
+#define PBUF_BENCH_NUM_SIZES \
+  (sizeof(pbuf_bench_sizes) / sizeof(pbuf_bench_sizes[0]))
+
+#define PBUF_BENCH_HELD 16 // Packets held at once
+
+typedef struct {
+  uint32_t payload;
+  uint32_t bytes;   // Buffer capacity of all packets
+  uint32_t peak;    // Most buffer capacity held at once
+  uint32_t bufs;
+  uint32_t packets;
+  uint32_t failed;
+  uint32_t heap;    // Largest heap growth seen while holding packets
+} pbuf_bench_stats_t;
+
+
+static pbuf_t *
+pbuf_bench_make(size_t len, int classed, pbuf_bench_stats_t *s)
+{
+  pbuf_t *head = NULL, *tail = NULL;
+  size_t remain = len;
+  uint32_t bytes = 0, bufs = 0;
+
+  while(remain) {
+    pbuf_t *pb = classed ?
+      pbuf_make_size(0, pbuf_data_class_fit(remain), 0) : pbuf_make(0, 0);
+    if(pb == NULL) {
+      pbuf_free(head);
+      return NULL;
+    }
+    const size_t cap = pbuf_data_size(pb->pb_data);
+    pb->pb_buflen = remain < cap ? remain : cap;
+    remain -= pb->pb_buflen;
+    bytes += cap;
+    bufs++;
+
+    if(head == NULL) {
+      head = pb;
+    } else {
+      tail->pb_flags &= ~PBUF_EOP;
+      pb->pb_flags &= ~PBUF_SOP;
+      tail->pb_next = pb;
+    }
+    tail = pb;
+  }
+  head->pb_pktlen = len;
+  s->bytes += bytes;
+  s->bufs += bufs;
+  return head;
+}
+
+
+static void
+pbuf_bench_run(cli_t *cli, const char *name, int rounds, int classed)
+{
+  pbuf_t *held[PBUF_BENCH_HELD];
+  pbuf_bench_stats_t s = {};
+  prng_t prng = {};
+  heap_stats_t hs;
+
+  heap_get_stats(&hs, -1);
+  const size_t heap_base = hs.used;
+
+  const int64_t start = clock_get();
+  for(int i = 0; i < rounds; i++) {
+    const uint32_t bytes = s.bytes;
+    for(int j = 0; j < PBUF_BENCH_HELD; j++) {
+      const uint32_t r = prng_get(&prng, i * PBUF_BENCH_HELD + j);
+      const size_t len = pbuf_bench_sizes[r % PBUF_BENCH_NUM_SIZES];
+      held[j] = pbuf_bench_make(len, classed, &s);
+      if(held[j] == NULL) {
+        s.failed++;
+        continue;
+      }
+      s.payload += len;
+      s.packets++;
+    }
+
+    if(s.bytes - bytes > s.peak)
+      s.peak = s.bytes - bytes;
+    heap_get_stats(&hs, -1);
+    if(hs.used > heap_base && hs.used - heap_base > s.heap)
+      s.heap = hs.used - heap_base;
+
+    for(int j = 0; j < PBUF_BENCH_HELD; j++)
+      pbuf_free(held[j]);
+  }
+  const int64_t elapsed = clock_get() - start;
+
+  if(s.packets == 0) {
+    cli_printf(cli, "%-8s No buffers\n", name);
+    return;
+  }
+  cli_printf(cli, "%-8s %3d%% efficiency, %d.%02d bufs/pkt, "
+             "%d ns/pkt, %d failed, pool %d bytes, heap +%d\n",
+             name, (int)((uint64_t)s.payload * 100 / s.bytes),
+             (int)(s.bufs / s.packets), (int)(s.bufs * 100 / s.packets % 100),
+             (int)(elapsed * 1000 / (rounds * PBUF_BENCH_HELD)),
+             (int)s.failed, (int)s.peak, (int)s.heap);
+}
+
+
+static error_t
+cmd_pbuf_bench(cli_t *cli, int argc, char **argv)
+{
+  const int rounds = argc > 1 ? atoi(argv[1]) : 100;
+  if(rounds < 1)
+    return ERR_INVALID_ARGS;
+
+  cli_printf(cli, "%d rounds of %d packets\n", rounds, PBUF_BENCH_HELD);
+  pbuf_bench_run(cli, "Single", rounds, 0);
+  pbuf_bench_run(cli, "Classes", rounds, 1);
+  return 0;
+}
+
+CLI_CMD_DEF("pbuf-bench", cmd_pbuf_bench);
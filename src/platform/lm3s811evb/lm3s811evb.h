@@ -3,3 +3,5 @@
 #define CPU_SYSTICK_RVR 14000000
 
 #define CORTEXM_IRQ_COUNT 32
+
+#define TIMER_WHEEL_BITS 3
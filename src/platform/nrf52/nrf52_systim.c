@@ -18,11 +18,12 @@
 #include "nrf52_rtc.h"
 
 static struct timer_list systim_rtc1_timers;
+static uint64_t systim_rtc1_deadline = UINT64_MAX;
 
 static void
-systim_rtc1_rearm(timer_t *t, int64_t now)
+systim_rtc1_rearm(uint64_t deadline, int64_t now)
 {
-  const int64_t delta = t->t_expire - now;
+  const int64_t delta = deadline - now;
   uint32_t delta32;
 
   if(delta < 2) {
@@ -40,6 +41,7 @@ systim_rtc1_rearm(timer_t *t, int64_t now)
   reg_wr(RTC1_BASE + TIMER_TASKS_CLEAR, 1);
   reg_wr(RTC1_BASE + TIMER_CC(0), delta32);
   reg_wr(RTC1_BASE + TIMER_TASKS_START, 1);
+  systim_rtc1_deadline = deadline;
 }
 
 
@@ -51,41 +53,22 @@ irq_17(void)
 
     const int64_t now = clock_get_irq_blocked();
 
-    while(1) {
-      timer_t *t = LIST_FIRST(&systim_rtc1_timers);
-      if(t == NULL)
-        break;
-
-      if(t->t_expire > now) {
-        systim_rtc1_rearm(t, now);
-        break;
-      }
-
-      uint64_t expire = t->t_expire;
-      LIST_REMOVE(t, t_link);
-      t->t_expire = 0;
-      t->t_cb(t->t_opaque, expire);
-    }
-  }
-}
-
+    systim_rtc1_deadline = UINT64_MAX;
+    timer_dispatch(&systim_rtc1_timers, now);
 
-static int
-systim_cmp(const timer_t *a, const timer_t *b)
-{
-  return a->t_expire > b->t_expire;
+    const uint64_t next = timer_next(&systim_rtc1_timers);
+    if(next != UINT64_MAX)
+      systim_rtc1_rearm(next, clock_get_irq_blocked());
+  }
 }
 
 
 void
 timer_arm_abs(timer_t *t, uint64_t deadline)
 {
-  timer_disarm(t);
-
-  t->t_expire = deadline;
-  LIST_INSERT_SORTED(&systim_rtc1_timers, t, t_link, systim_cmp);
-  if(t == LIST_FIRST(&systim_rtc1_timers))
-    systim_rtc1_rearm(t, clock_get_irq_blocked());
+  timer_arm_on_queue(t, deadline, &systim_rtc1_timers);
+  if(deadline < systim_rtc1_deadline)
+    systim_rtc1_rearm(deadline, clock_get_irq_blocked());
 }
 
 
@@ -0,0 +1,52 @@
+#include <stddef.h>
+
+#include <mios/perf.h>
+#include <mios/error.h>
+
+#include "irq.h"
+
+// Free-running basic timer at 1MHz for the sampling profiler. ARR is
+// rewritten on every update so each period is randomized
+
+static uint32_t perf_tim_base;
+
+static void
+perf_tim_irq(void *arg)
+{
+  const uint32_t regbase = perf_tim_base;
+  reg_wr(regbase + TIMx_SR, 0x0);
+  reg_wr(regbase + TIMx_ARR, perf_sample_irq() - 1);
+}
+
+
+static error_t
+stm32_perf_start(uint32_t regbase, uint16_t clkid, int irq, uint32_t period)
+{
+  if(period + period / 2 > 65536)
+    return ERR_INVALID_ARGS; // Randomized period won't fit in 16 bits
+
+  clk_enable(clkid);
+  if(!clk_is_enabled(clkid))
+    return ERR_NO_DEVICE;
+
+  perf_tim_base = regbase;
+  reg_wr(regbase + TIMx_CR1, 0x0);
+  reg_wr(regbase + TIMx_PSC, clk_get_freq(clkid) / 1000000 - 1);
+  reg_wr(regbase + TIMx_ARR, period - 1);
+  reg_wr(regbase + TIMx_EGR, 0x1); // Load prescaler
+  reg_wr(regbase + TIMx_SR, 0x0);
+  reg_wr(regbase + TIMx_DIER, 0x1);
+  irq_enable_fn_arg(irq, IRQ_LEVEL_CLOCK, perf_tim_irq, NULL);
+  reg_wr(regbase + TIMx_CR1, 0x1);
+  return 0;
+}
+
+
+void
+perf_hwtimer_stop(void)
+{
+  const uint32_t regbase = perf_tim_base;
+  reg_wr(regbase + TIMx_CR1, 0x0);
+  reg_wr(regbase + TIMx_DIER, 0x0);
+  reg_wr(regbase + TIMx_SR, 0x0);
+}
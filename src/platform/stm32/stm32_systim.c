@@ -14,6 +14,7 @@
 
 typedef struct {
   uint32_t regbase;
+  uint64_t deadline; // What the hardware is armed for
   struct timer_list timers;
 } systim_t;
 
@@ -84,14 +85,9 @@ systim_dump_trace(stream_t *s)
              ht->t);
   }
 
-  const timer_t *t;
-  LIST_FOREACH(t, &st->timers, t_link) {
-    stprintf(s, "%p %p %p %15d %15d %s\n",
-               t, t->t_cb, t->t_opaque,
-               (int)t->t_expire,
-               (int)(t->t_expire - now),
-               t->t_name);
-  }
+  const uint64_t next = timer_next(&st->timers);
+  if(next != UINT64_MAX)
+    stprintf(s, "Next: %15d %15d\n", (int)next, (int)(next - now));
 }
 
 
@@ -103,9 +99,9 @@ systim_dump_trace(stream_t *s)
 #endif
 
 static void
-systim_rearm(timer_t *t, int64_t now, systim_t *st)
+systim_rearm(uint64_t deadline, int64_t now, systim_t *st)
 {
-  const int64_t delta = t->t_expire - now;
+  const int64_t delta = deadline - now;
   const uint32_t regbase = st->regbase;
   reg_wr(regbase + TIMx_CR1, 0x0);
   uint32_t arr;
@@ -118,11 +114,12 @@ systim_rearm(timer_t *t, int64_t now, systim_t *st)
   }
 
 #ifdef SYSTIM_TRACE
-  systim_trace_add(now, t, arr, SYSTIM_TRACE_ARM);
+  systim_trace_add(now, NULL, arr, SYSTIM_TRACE_ARM);
 #endif
   reg_wr(regbase + TIMx_CNT, 0xffff);
   reg_wr(regbase + TIMx_ARR, arr);
   reg_wr(regbase + TIMx_CR1, 0x9);
+  st->deadline = deadline;
 }
 
 
@@ -138,39 +135,12 @@ systim_irq(void *arg)
   systim_trace_add(now, NULL, 0, SYSTIM_TRACE_IRQ);
 #endif
 
-  while(1) {
-    timer_t *t = LIST_FIRST(&st->timers);
-    if(t == NULL)
-      break;
-
-    if(t->t_expire > now) {
-      systim_rearm(t, now, st);
-      break;
-    }
-
-#ifdef SYSTIM_TRACE
-    systim_trace_add(now, t, 0, SYSTIM_TRACE_FIRE);
-
-    int64_t miss = now - t->t_expire;
-    if(miss > 500) {
-      systim_dump_trace(stdio);
-      panic("Timer %p \"%s\"  missed with %d",
-            t, t->t_name, (int)miss);
-    }
-#endif
-
-    uint64_t expire = t->t_expire;
-    LIST_REMOVE(t, t_link);
-    t->t_expire = 0;
-    t->t_cb(t->t_opaque, expire);
-  }
-}
-
+  st->deadline = UINT64_MAX;
+  timer_dispatch(&st->timers, now);
 
-static int
-systim_cmp(const timer_t *a, const timer_t *b)
-{
-  return a->t_expire > b->t_expire;
+  const uint64_t next = timer_next(&st->timers);
+  if(next != UINT64_MAX)
+    systim_rearm(next, clock_get_irq_blocked(), st);
 }
 
 
@@ -179,12 +149,9 @@ timer_arm_abs(timer_t *t, uint64_t deadline)
 {
   systim_t *st = &g_systim;
 
-  timer_disarm(t);
-
-  t->t_expire = deadline;
-  LIST_INSERT_SORTED(&st->timers, t, t_link, systim_cmp);
-  if(t == LIST_FIRST(&st->timers))
-    systim_rearm(t, clock_get_irq_blocked(), st);
+  timer_arm_on_queue(t, deadline, &st->timers);
+  if(deadline < st->deadline)
+    systim_rearm(deadline, clock_get_irq_blocked(), st);
 }
 
 
@@ -196,6 +163,7 @@ stm32_systim_init(uint32_t regbase, uint16_t clkid, int irq)
     return ERR_NO_DEVICE;
   systim_t *st = &g_systim;
   st->regbase = regbase;
+  st->deadline = UINT64_MAX;
   reg_wr(regbase + TIMx_PSC, clk_get_freq(clkid) / 1000000 - 1);
   reg_wr(regbase + TIMx_DIER, 0x1);
   reg_wr(regbase + TIMx_CR1, 0x0);
@@ -23,6 +23,8 @@ SRCS += ${C}/systick.c \
 	${P}/stm32f4_otgfs.c \
 	${P}/stm32f4_systim.c \
 
+SRCS-${ENABLE_PERF} += ${P}/stm32f4_perf.c
+
 SRCS-${ENABLE_NET_IPV4} += \
 	${P}/stm32f4_eth.c \
 
@@ -0,0 +1,11 @@
+#include "stm32f4_reg.h"
+#include "stm32f4_tim.h"
+#include "stm32f4_clk.h"
+
+#include "platform/stm32/stm32_perf.c"
+
+const char *
+perf_hwtimer_start(uint32_t period)
+{
+  return stm32_perf_start(TIM6_BASE, CLK_TIM6, 54, period) ? NULL : "tim6";
+}
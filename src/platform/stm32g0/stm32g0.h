@@ -3,3 +3,5 @@
 #define CORTEXM_IRQ_COUNT 32
 
 #define PBUF_DATA_SIZE 64
+
+#define TIMER_WHEEL_BITS 3
@@ -29,6 +29,8 @@ SRCS-${ENABLE_NET_MBUS} += \
 
 SRCS-${ENABLE_SYSTIM} += ${P}/stm32g0_systim.c
 
+SRCS-${ENABLE_PERF} += ${P}/stm32g0_perf.c
+
 SRCS-${ENABLE_BUILTIN_BOOTLOADER} += \
 	${P}/boot/stm32g0_bootloader.c \
 	${P}/boot/isr.s \
@@ -0,0 +1,16 @@
+#include "stm32g0_reg.h"
+#include "stm32g0_tim.h"
+#include "stm32g0_clk.h"
+
+#include "platform/stm32/stm32_perf.c"
+
+const char *
+perf_hwtimer_start(uint32_t period)
+{
+  // TIM6 is missing on smaller parts
+  if(!stm32_perf_start(TIM6_BASE, CLK_TIM6, 17, period))
+    return "tim6";
+  if(!stm32_perf_start(TIM14_BASE, CLK_TIM14, 19, period))
+    return "tim14";
+  return NULL;
+}
@@ -29,6 +29,8 @@ SRCS += ${C}/systick.c \
 	${P}/stm32g4_rtc.c \
 	${P}/stm32g4_opt.c \
 
+SRCS-${ENABLE_PERF} += ${P}/stm32g4_perf.c
+
 ${MO}/src/platform/stm32g4/%.o : CFLAGS += ${NOFPU}
 
 SRCS-${ENABLE_BUILTIN_BOOTLOADER} += \
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "cpu.h"
+#include "reg.h"
 
 #include "pl011.h"
 
@@ -16,3 +17,19 @@ vexpress_a9_init_heap(void)
 
   stdio = pl011_uart_init(0x10009000, 115200, 37);
 }
+
+#ifdef ENABLE_SMP
+
+#define SYS_FLAGSSET 0x10000030
+#define SYS_FLAGSCLR 0x10000034
+
+static void  __attribute__((constructor(1000)))
+vexpress_a9_init_smp(void)
+{
+  // The boot monitor releases secondary cores to the address in SYS_FLAGS
+  reg_wr(SYS_FLAGSCLR, 0xffffffff);
+  reg_wr(SYS_FLAGSSET, (uint32_t)secondary_start);
+  smp_init();
+}
+
+#endif
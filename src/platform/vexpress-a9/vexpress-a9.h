@@ -1,3 +1,5 @@
 #pragma once
 
 #define CPU_TIMER_CLOCK 100000000
+
+#define CPU_MAX 4
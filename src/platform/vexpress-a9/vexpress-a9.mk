@@ -1,6 +1,7 @@
 
 ENABLE_TASK_DEBUG := yes
 ENABLE_NET_IPV4 := yes
+ENABLE_SMP ?= yes
 
 PLATFORM := vexpress-a9
 
@@ -30,11 +31,13 @@ ${P}/%.o : CFLAGS += ${NOFPU}
 ${PE}/%.o : CFLAGS += ${NOFPU}
 
 
+QEMU_SMP := $(if $(subst no,,${ENABLE_SMP}),4,1)
+
 run: ${O}/build.elf
-	qemu-system-arm -M vexpress-a9 -m 32M -nographic -kernel $<
+	qemu-system-arm -M vexpress-a9 -smp ${QEMU_SMP} -m 32M -nographic -kernel $<
 
 qemu:
-	qemu-system-arm -S -s -M vexpress-a9 -m 32M -nographic
+	qemu-system-arm -S -s -M vexpress-a9 -smp ${QEMU_SMP} -m 32M -nographic
 
 gdb: ${O}/build.elf
 	${GDB} -ex "target extended-remote localhost:1234" ${O}/build.elf
@@ -1,21 +1,110 @@
 #include <mios/bumpalloc.h>
+#include <mios/task.h>
+#include <mios/cli.h>
 
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
 
+#define BALLOC_CHUNK_SIZE 1024
+
+#ifndef BALLOC_FREE_CHUNKS
+#define BALLOC_FREE_CHUNKS 4 // Standard sized chunks kept for reuse
+#endif
+
+struct balloc_chunk {
+  balloc_chunk_t *next;
+  size_t capacity;
+  size_t used;
+  uint8_t data[0];
+};
+
+static mutex_t balloc_mutex = MUTEX_INITIALIZER("balloc");
+static balloc_chunk_t *balloc_free_chunks;
+
+static struct {
+  uint32_t allocs; // Chunks taken from the heap
+  uint32_t reuses; // Chunks taken from the free list
+  uint32_t fails;
+  size_t peak;     // Largest arena seen
+  uint8_t num_free;
+} balloc_stats;
+
 
 balloc_t *
 balloc_create(size_t capacity)
 {
   balloc_t *ba = xalloc(sizeof(balloc_t) + capacity, 0, MEM_MAY_FAIL);
-  if(ba != NULL) {
-    ba->capacity = capacity;
-    ba->used = 0;
-  }
+  if(ba != NULL)
+    balloc_init(ba, capacity, 0);
   return ba;
 }
 
+
+void
+balloc_init(balloc_t *ba, size_t capacity, size_t limit)
+{
+  ba->chunks = NULL;
+  ba->limit = limit;
+  ba->chained = 0;
+  ba->peak = 0;
+  ba->capacity = capacity;
+  ba->used = 0;
+}
+
+
+static balloc_chunk_t *
+balloc_grow(balloc_t *ba, size_t need)
+{
+  const size_t capacity = need > BALLOC_CHUNK_SIZE ? need : BALLOC_CHUNK_SIZE;
+  if(ba->chained + capacity > ba->limit)
+    return NULL;
+
+  balloc_chunk_t *c = NULL;
+  mutex_lock(&balloc_mutex);
+  if(capacity == BALLOC_CHUNK_SIZE && balloc_free_chunks != NULL) {
+    c = balloc_free_chunks;
+    balloc_free_chunks = c->next;
+    balloc_stats.num_free--;
+    balloc_stats.reuses++;
+  }
+  mutex_unlock(&balloc_mutex);
+
+  if(c == NULL) {
+    c = xalloc(sizeof(balloc_chunk_t) + capacity, 0, MEM_MAY_FAIL);
+    if(c == NULL) {
+      balloc_stats.fails++;
+      return NULL;
+    }
+    balloc_stats.allocs++;
+  }
+
+  c->capacity = capacity;
+  c->used = 0;
+  c->next = ba->chunks;
+  ba->chunks = c;
+  ba->chained += capacity;
+  return c;
+}
+
+
+static void
+balloc_chunk_release(balloc_chunk_t *c)
+{
+  if(c->capacity == BALLOC_CHUNK_SIZE) {
+    mutex_lock(&balloc_mutex);
+    if(balloc_stats.num_free < BALLOC_FREE_CHUNKS) {
+      c->next = balloc_free_chunks;
+      balloc_free_chunks = c;
+      balloc_stats.num_free++;
+      c = NULL;
+    }
+    mutex_unlock(&balloc_mutex);
+  }
+  free(c);
+}
+
+
 void *
 balloc_append_data(balloc_t *ba, const void *src, size_t srclen,
                    void **ptr, size_t *sizep)
@@ -23,23 +112,52 @@ balloc_append_data(balloc_t *ba, const void *src, size_t srclen,
   if(ba == NULL)
     return NULL;
 
+  balloc_chunk_t *c = ba->chunks;
+  uint8_t *data = c ? c->data : ba->data;
+  size_t *used = c ? &c->used : &ba->used;
+  const size_t capacity = c ? c->capacity : ba->capacity;
+
+  // Can only append to the latest allocation
+  if(*ptr != NULL &&
+     ((uint8_t *)*ptr < data || (uint8_t *)*ptr > data + *used))
+    return NULL;
+
+  // Includes terminating zero for strings
+  const size_t cur = *ptr ? data + *used - (uint8_t *)*ptr : !sizep;
+
+  if((*ptr ? *used : *used + cur) + srclen >= capacity) {
+    if(ba->limit == 0)
+      return NULL;
+    // Move what we have so far to a new chunk, with room to keep
+    // growing if it is large
+    size_t need = cur + srclen + 1;
+    if(need > BALLOC_CHUNK_SIZE / 2 && ba->chained + 2 * need <= ba->limit)
+      need *= 2;
+    balloc_chunk_t *nc = balloc_grow(ba, need);
+    if(nc == NULL)
+      return NULL;
+    if(*ptr != NULL) {
+      memcpy(nc->data, *ptr, cur);
+      *used -= cur;
+      *ptr = nc->data;
+      nc->used = cur;
+    }
+    data = nc->data;
+    used = &nc->used;
+  }
+
   if(*ptr == NULL) {
-    *ptr = ba->data + ba->used;
+    *ptr = data + *used;
     // Null terminated string
     if(sizep == NULL) {
-      if(ba->used + 1 >= ba->capacity)
-        return NULL;
-      ba->data[ba->used] = 0;
-      ba->used++;
+      data[*used] = 0;
+      (*used)++;
     } else {
       *sizep = 0;
     }
   }
 
-  if(ba->used + srclen >= ba->capacity)
-    return NULL;
-
-  uint8_t *d = ba->data + ba->used - (sizep ? 0 : 1);
+  uint8_t *d = data + *used - (sizep ? 0 : 1);
   memcpy(d, src, srclen);
   if(sizep) {
     *sizep = *sizep + srclen;
@@ -47,7 +165,7 @@ balloc_append_data(balloc_t *ba, const void *src, size_t srclen,
     d[srclen] = 0;
   }
 
-  ba->used += srclen;
+  *used += srclen;
   return d;
 }
 
@@ -58,12 +176,88 @@ balloc_alloc(balloc_t *ba, size_t size)
   if(ba == NULL)
     return NULL;
 
-  ba->used = (ba->used + 3) & ~3;
+  balloc_chunk_t *c = ba->chunks;
+  uint8_t *data = c ? c->data : ba->data;
+  size_t *used = c ? &c->used : &ba->used;
+  const size_t capacity = c ? c->capacity : ba->capacity;
 
-  if(ba->used + size >= ba->capacity)
-    return NULL;
+  *used = (*used + 3) & ~3;
+
+  if(*used + size >= capacity) {
+    if(ba->limit == 0)
+      return NULL;
+    c = balloc_grow(ba, size + 1);
+    if(c == NULL)
+      return NULL;
+    data = c->data;
+    used = &c->used;
+  }
 
-  void *r = ba->data + ba->used;
-  ba->used += size;
+  void *r = data + *used;
+  *used += size;
   return r;
 }
+
+
+size_t
+balloc_size(const balloc_t *ba)
+{
+  size_t size = ba->used;
+  for(const balloc_chunk_t *c = ba->chunks; c != NULL; c = c->next)
+    size += c->used;
+  return size;
+}
+
+
+balloc_mark_t
+balloc_mark(const balloc_t *ba)
+{
+  return (balloc_mark_t){
+    .chunk = ba->chunks,
+    .used = ba->chunks ? ba->chunks->used : ba->used
+  };
+}
+
+
+void
+balloc_rewind(balloc_t *ba, balloc_mark_t mark)
+{
+  const size_t size = balloc_size(ba);
+  if(size > ba->peak) {
+    ba->peak = size;
+    if(size > balloc_stats.peak)
+      balloc_stats.peak = size;
+  }
+
+  while(ba->chunks != mark.chunk) {
+    balloc_chunk_t *c = ba->chunks;
+    ba->chunks = c->next;
+    ba->chained -= c->capacity;
+    balloc_chunk_release(c);
+  }
+
+  if(ba->chunks)
+    ba->chunks->used = mark.used;
+  else
+    ba->used = mark.used;
+}
+
+
+void
+balloc_reset(balloc_t *ba)
+{
+  balloc_rewind(ba, (balloc_mark_t){});
+}
+
+
+static error_t
+cmd_balloc(cli_t *cli, int argc, char **argv)
+{
+  cli_printf(cli, "Chunks: %d allocated, %d reused, %d failed, %d free\n",
+             (int)balloc_stats.allocs, (int)balloc_stats.reuses,
+             (int)balloc_stats.fails, balloc_stats.num_free);
+  cli_printf(cli, "Largest arena: %d bytes\n", (int)balloc_stats.peak);
+  return 0;
+}
+
+CLI_CMD_DEF("balloc", cmd_balloc);